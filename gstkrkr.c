@@ -121,9 +121,19 @@ struct _GstKrkrPlMpegVideo
 	
 	int width;
 	int height;
+	int scale;
+	bool incremental;
 	
 	plm_buffer_t* buf;
 	plm_video_t* decode;
+	GstBufferPool* pool; // output buffers, created once the sequence header is there
+};
+
+enum
+{
+	PROP_0,
+	PROP_SCALE,
+	PROP_INCREMENTAL,
 };
 
 static GstStaticPadTemplate decodevideo_sink_factory = GST_STATIC_PAD_TEMPLATE(
@@ -146,18 +156,100 @@ GST_ELEMENT_REGISTER_DECLARE(krkr_video);
 GST_ELEMENT_REGISTER_DEFINE(krkr_video, "krkr_mpegvideo", VIDEO_RANK, GST_TYPE_PLMPEG_VIDEO);
 
 static void gst_krkr_video_finalize(GObject* object);
+static void gst_krkr_video_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec);
+static void gst_krkr_video_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec);
 
 static gboolean gst_krkr_video_sink_event(GstPad* pad, GstObject* parent, GstEvent* event);
 static GstFlowReturn gst_krkr_video_sink_chain(GstPad* pad, GstObject* parent, GstBuffer* buf);
+static void gst_krkr_video_push_frames(GstKrkrPlMpegVideo* filter);
 static gboolean gst_krkr_video_src_event(GstPad* pad, GstObject* parent, GstEvent* event);
 static gboolean gst_krkr_video_src_query(GstPad* pad, GstObject* parent, GstQuery* query);
 
+// without a GstVideoMeta, downstream assumes the default YV12 layout from gst_video_info_set_format:
+// rows padded to 4 bytes, and chroma planes half the luma size rounded up to even
+static int gst_krkr_luma_stride(int width)
+{
+	return GST_ROUND_UP_4(width);
+}
+
+static int gst_krkr_chroma_stride(int width)
+{
+	return GST_ROUND_UP_4(GST_ROUND_UP_2(width) / 2);
+}
+
+static size_t gst_krkr_yv12_size(int width, int height)
+{
+	return gst_krkr_luma_stride(width) * GST_ROUND_UP_2(height) + gst_krkr_chroma_stride(width) * GST_ROUND_UP_2(height);
+}
+
+// buffers go back to the pool once both the decoder and downstream are done with them,
+// so after the first few frames, nothing is allocated anymore
+static GstBuffer* gst_krkr_video_acquire_buffer(GstKrkrPlMpegVideo* filter, uint8_t** ptr)
+{
+	GstBuffer* buf;
+	GstMapInfo meminf;
+	gst_buffer_pool_acquire_buffer(filter->pool, &buf, NULL);
+	gst_buffer_map(buf, &meminf, GST_MAP_WRITE);
+	*ptr = meminf.data; // it's system memory, which stays where it is after unmapping
+	gst_buffer_unmap(buf, &meminf);
+	return buf;
+}
+
+// frames are decoded straight into GstBuffers, laid out like YV12 (Y, then V=Cr, then U=Cb)
+// only used if the planes are the size of the picture, so the frame is the finished image
+static void gst_krkr_video_alloc_frame(plm_video_t* decode, plm_frame_t* frame, void* user)
+{
+	// the planes are a whole number of macroblocks, so their height is even already
+	frame->y.stride = gst_krkr_luma_stride(frame->y.width);
+	frame->cr.stride = gst_krkr_chroma_stride(frame->y.width);
+	frame->cb.stride = frame->cr.stride;
+	size_t y_size = frame->y.stride * frame->y.height;
+	size_t c_size = frame->cr.stride * frame->cr.height;
+	uint8_t* ptr;
+	frame->user = gst_krkr_video_acquire_buffer(user, &ptr);
+	frame->y.data = ptr;
+	frame->cr.data = ptr + y_size;
+	frame->cb.data = ptr + y_size + c_size;
+}
+
+static void gst_krkr_video_release_frame(plm_video_t* decode, plm_frame_t* frame, void* user)
+{
+	gst_buffer_unref(frame->user);
+}
+
+#define GST_TYPE_KRKR_SCALE (gst_krkr_scale_get_type())
+static GType gst_krkr_scale_get_type(void)
+{
+	static GType type = 0;
+	static const GEnumValue values[] = {
+		{ 1, "Full size", "1" },
+		{ 2, "Half size", "2" },
+		{ 4, "Quarter size", "4" },
+		{ 0, NULL, NULL },
+	};
+	if (!type)
+		type = g_enum_register_static("GstKrkrScale", values);
+	return type;
+}
+
 static void gst_krkr_video_class_init(GstKrkrPlMpegVideoClass* klass)
 {
 	GObjectClass* gobject_class = G_OBJECT_CLASS(klass);
 	GstElementClass* gstelement_class = GST_ELEMENT_CLASS(klass);
 	
 	gobject_class->finalize = gst_krkr_video_finalize;
+	gobject_class->set_property = gst_krkr_video_set_property;
+	gobject_class->get_property = gst_krkr_video_get_property;
+	
+	// for small layers and thumbnails; decoding at a smaller size is much cheaper than scaling down afterwards
+	g_object_class_install_property(gobject_class, PROP_SCALE,
+		g_param_spec_enum("scale", "Scale", "Decode at 1/scale of the video size",
+			GST_TYPE_KRKR_SCALE, 1, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+	// incremental decoding can't hand the pictures to the worker threads, so it's one or the other
+	g_object_class_install_property(gobject_class, PROP_INCREMENTAL,
+		g_param_spec_boolean("incremental", "Incremental",
+			"Decode the macroblocks as the demuxer pushes them, on one thread, rather than all at once on every core when the next picture shows up",
+			false, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
 	
 	gst_element_class_set_details_simple(gstelement_class,
 		"krkr_mpegvideo",
@@ -183,8 +275,12 @@ static void gst_krkr_video_init(GstKrkrPlMpegVideo* filter)
 	GST_OBJECT_FLAG_SET(filter->srcpad, GST_PAD_FLAG_NEED_PARENT);
 	gst_element_add_pad(GST_ELEMENT(filter), filter->srcpad);
 	
-	filter->buf = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
+	filter->buf = plm_buffer_create_with_chunks();
 	filter->decode = plm_video_create_with_buffer(filter->buf, false);
+	filter->pool = NULL;
+	plm_video_set_threads(filter->decode, g_get_num_processors());
+	filter->scale = 1;
+	filter->incremental = false;
 	
 	//fprintf(stderr, "gstkrkr: Created a decoder\n");
 }
@@ -195,10 +291,66 @@ static void gst_krkr_video_finalize(GObject* object)
 	
 	plm_buffer_destroy(filter->buf);
 	plm_video_destroy(filter->decode);
+	if (filter->pool)
+	{
+		gst_buffer_pool_set_active(filter->pool, false);
+		gst_object_unref(filter->pool);
+	}
 	
 	G_OBJECT_CLASS(gst_krkr_video_parent_class)->finalize(object);
 }
 
+static void gst_krkr_video_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec)
+{
+	GstKrkrPlMpegVideo* filter = GST_KRKRPLMPEG_VIDEO(object);
+	
+	switch (prop_id)
+	{
+	case PROP_SCALE:
+		// the output caps and buffers are for the scale they were set up with; the decoder could switch, but downstream wouldn't know
+		if (gst_pad_has_current_caps(filter->srcpad) || filter->pool)
+		{
+			GST_WARNING_OBJECT(filter, "can't change the scale once decoding has started");
+			break;
+		}
+		filter->scale = g_value_get_enum(value);
+		plm_video_set_scale(filter->decode, filter->scale);
+		break;
+	case PROP_INCREMENTAL:
+		// switching the threads drops the B-pictures they decoded ahead
+		if (gst_pad_has_current_caps(filter->srcpad))
+		{
+			GST_WARNING_OBJECT(filter, "can't switch incremental decoding once the caps are set");
+			break;
+		}
+		filter->incremental = g_value_get_boolean(value);
+		plm_video_set_incremental(filter->decode, filter->incremental);
+		plm_video_set_threads(filter->decode, filter->incremental ? 1 : g_get_num_processors());
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_krkr_video_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec)
+{
+	GstKrkrPlMpegVideo* filter = GST_KRKRPLMPEG_VIDEO(object);
+	
+	switch (prop_id)
+	{
+	case PROP_SCALE:
+		g_value_set_enum(value, filter->scale);
+		break;
+	case PROP_INCREMENTAL:
+		g_value_set_boolean(value, filter->incremental);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
 static gboolean gst_krkr_video_sink_event(GstPad* pad, GstObject* parent, GstEvent* event)
 {
 	print_event("video sink", event);
@@ -225,10 +377,36 @@ static gboolean gst_krkr_video_sink_event(GstPad* pad, GstObject* parent, GstEve
 		// (I omit some of them)
 		int framerate_n;
 		int framerate_d;
-		if (gst_structure_get_int(struc, "width", &filter->width) &&
+		bool have_size = gst_structure_get_int(struc, "width", &filter->width) &&
 			gst_structure_get_int(struc, "height", &filter->height) &&
-			gst_structure_get_fraction(struc, "framerate", &framerate_n, &framerate_d))
+			gst_structure_get_fraction(struc, "framerate", &framerate_n, &framerate_d);
+		
+		// if only the sequence header is there, read the size from that
+		const GValue* codec_data = gst_structure_get_value(struc, "codec_data");
+		if (!have_size && codec_data && GST_VALUE_HOLDS_BUFFER(codec_data))
+		{
+			GstMapInfo meminf;
+			GstBuffer* buf = gst_value_get_buffer(codec_data);
+			if (gst_buffer_map(buf, &meminf, GST_MAP_READ))
+			{
+				plm_info_t info;
+				if (plm_probe_sequence_header(meminf.data, meminf.size, &info) && info.framerate > 0)
+				{
+					filter->width = info.width;
+					filter->height = info.height;
+					framerate_n = info.framerate * 1000;
+					framerate_d = 1000;
+					have_size = true;
+				}
+				gst_buffer_unmap(buf, &meminf);
+			}
+		}
+		
+		if (have_size)
 		{
+			// same rounding as the decoder
+			filter->width = (filter->width + filter->scale - 1) / filter->scale;
+			filter->height = (filter->height + filter->scale - 1) / filter->scale;
 			GstCaps* caps_out = gst_caps_new_simple("video/x-raw",
 				"format", G_TYPE_STRING, "YV12",
 				"width", G_TYPE_INT, filter->width,
@@ -243,6 +421,13 @@ static gboolean gst_krkr_video_sink_event(GstPad* pad, GstObject* parent, GstEve
 		}
 		return TRUE;
 	}
+	case GST_EVENT_EOS:
+	{
+		// without incremental decoding, the last picture waits for the start code of a next one
+		plm_buffer_signal_end(filter->buf);
+		gst_krkr_video_push_frames(filter);
+		return gst_pad_event_default(pad, parent, event);
+	}
 	case GST_EVENT_SEGMENT:
 	{
 		if (!filter->width)
@@ -254,22 +439,65 @@ static gboolean gst_krkr_video_sink_event(GstPad* pad, GstObject* parent, GstEve
 	}
 }
 
+// the decoder reads straight from the GstMemory, which stays mapped until it's done with it
+struct krkr_chunk
+{
+	GstMemory* mem;
+	GstMapInfo meminf;
+};
+
+static void gst_krkr_video_release_chunk(plm_buffer_t* buf, void* user)
+{
+	struct krkr_chunk* chunk = user;
+	gst_memory_unmap(chunk->mem, &chunk->meminf);
+	gst_memory_unref(chunk->mem);
+	g_free(chunk);
+}
+
 static GstFlowReturn gst_krkr_video_sink_chain(GstPad* pad, GstObject* parent, GstBuffer* buf)
 {
 //fprintf(stderr, "gstkrkr: reading\n");
 	GstKrkrPlMpegVideo* filter = GST_KRKRPLMPEG_VIDEO(parent);
 	for (size_t n=0;n<gst_buffer_n_memory(buf);n++)
 	{
-		GstMapInfo meminf;
-		GstMemory* mem = gst_buffer_get_memory(buf, n);
-		mem = gst_memory_make_mapped(mem, &meminf, GST_MAP_READ);
-//fprintf(stderr, "gstkrkr: read %zu bytes\n", meminf.size);
-		plm_buffer_write(filter->buf, meminf.data, meminf.size);
-		gst_memory_unmap(mem, &meminf);
-		gst_memory_unref(mem);
+		struct krkr_chunk* chunk = g_new(struct krkr_chunk, 1);
+		chunk->mem = gst_memory_make_mapped(gst_buffer_get_memory(buf, n), &chunk->meminf, GST_MAP_READ);
+		if (!chunk->mem)
+		{
+			g_free(chunk);
+			continue;
+		}
+//fprintf(stderr, "gstkrkr: read %zu bytes\n", chunk->meminf.size);
+		plm_buffer_write_chunk(filter->buf, chunk->meminf.data, chunk->meminf.size, gst_krkr_video_release_chunk, chunk);
 	}
 	gst_buffer_unref(buf);
 	
+	gst_krkr_video_push_frames(filter);
+	return GST_FLOW_OK;
+}
+
+// once the size is known, set up the output buffers, and decode into them if no cropping is needed
+static void gst_krkr_video_init_pool(GstKrkrPlMpegVideo* filter)
+{
+	int width = plm_video_get_width(filter->decode);
+	int height = plm_video_get_height(filter->decode);
+	filter->pool = gst_buffer_pool_new();
+	GstStructure* config = gst_buffer_pool_get_config(filter->pool);
+	gst_buffer_pool_config_set_params(config, NULL, gst_krkr_yv12_size(width, height), 0, 0);
+	gst_buffer_pool_set_config(filter->pool, config);
+	gst_buffer_pool_set_active(filter->pool, true);
+	
+	// the planes are whole macroblocks, 16/scale pixels each; if the picture is too, there's no padding to crop
+	int mb_size = 16 / filter->scale;
+	if (width % mb_size == 0 && height % mb_size == 0)
+		plm_video_set_frame_allocator(filter->decode, gst_krkr_video_alloc_frame, gst_krkr_video_release_frame, filter);
+}
+
+static void gst_krkr_video_push_frames(GstKrkrPlMpegVideo* filter)
+{
+	if (!filter->pool && plm_video_has_header(filter->decode))
+		gst_krkr_video_init_pool(filter);
+	
 	while (true)
 	{
 		plm_frame_t* frame = plm_video_decode(filter->decode);
@@ -296,23 +524,22 @@ static GstFlowReturn gst_krkr_video_sink_chain(GstPad* pad, GstObject* parent, G
 				gst_pad_push_event(filter->srcpad, segment);
 		}
 		
-		size_t buflen = frame->width*frame->height*12/8;
-		uint8_t* ptr = g_malloc(buflen);
-		GstBuffer* buf2 = gst_buffer_new_wrapped(ptr, buflen);
-		for (int y=0;y<frame->height;y++)
+		GstBuffer* buf2;
+		if (frame->user)
 		{
-			memcpy(ptr, frame->y.data + frame->y.width*y, frame->width);
-			ptr += frame->width;
+			// the frame is already a YV12 image; push it as is (the decoder never writes to it again)
+			buf2 = gst_buffer_ref(frame->user);
 		}
-		for (int y=0;y<frame->height/2;y++)
-		{
-			memcpy(ptr, frame->cr.data + frame->cr.width*y, frame->width/2);
-			ptr += frame->width/2;
-		}
-		for (int y=0;y<frame->height/2;y++)
+		else
 		{
-			memcpy(ptr, frame->cb.data + frame->cb.width*y, frame->width/2);
-			ptr += frame->width/2;
+			// the decoder's own frames are padded to whole macroblocks; copy the picture out of them
+			int y_stride = gst_krkr_luma_stride(frame->width);
+			int c_stride = gst_krkr_chroma_stride(frame->width);
+			size_t y_size = y_stride * GST_ROUND_UP_2(frame->height);
+			size_t c_size = c_stride * (GST_ROUND_UP_2(frame->height) / 2);
+			uint8_t* ptr;
+			buf2 = gst_krkr_video_acquire_buffer(filter, &ptr);
+			plm_frame_to_yuv420p(frame, ptr, y_stride, ptr + y_size + c_size, c_stride, ptr + y_size, c_stride);
 		}
 		
 		buf2->pts = frame->time * 1000000000;
@@ -321,8 +548,6 @@ static GstFlowReturn gst_krkr_video_sink_chain(GstPad* pad, GstObject* parent, G
 //fprintf(stderr, "gstkrkr: send frame, %zu bytes\n", gst_buffer_get_size(buf2));
 		gst_pad_push(filter->srcpad, buf2);
 	}
-	
-	return GST_FLOW_OK;
 }
 
 static gboolean gst_krkr_video_src_event(GstPad* pad, GstObject* parent, GstEvent* event)
@@ -153,6 +153,20 @@ will realloc() the buffer with a larger size whenever needed. You can configure
 the default buffer size by defining PLM_BUFFER_DEFAULT_SIZE *before* 
 including this library.
 
+On x86 with GCC or Clang, the hot loops of the video decoder have SSE2 and AVX2
+versions that are selected at runtime depending on the CPU. The plain C
+versions are kept as the reference and produce bit-identical output. Define
+PLM_NO_SIMD *before* including this library to always use the C versions.
+
+The video decoder can optionally decode slices and B-pictures on several
+threads, see plm_video_set_threads(). This uses pthreads and is available on
+Unix-like systems; define PLM_NO_THREADS *before* including this library to
+leave it out.
+
+Define PLM_PROFILE *before* including this library to count the time spent in
+each stage of decoding, see plm_get_profile(). Without it, nothing is counted
+and the library is exactly as fast as before.
+
 
 See below for detailed the API documentation.
 
@@ -199,23 +213,26 @@ typedef struct {
 
 
 // Decoded Video Plane 
-// The byte length of the data is width * height. Note that different planes
+// The byte length of the data is stride * height. Note that different planes
 // have different sizes: the Luma plane (Y) is double the size of each of 
 // the two Chroma planes (Cr, Cb) - i.e. 4 times the byte length.
 // Also note that the size of the plane does *not* denote the size of the 
 // displayed frame. The sizes of planes are always rounded up to the nearest
-// macroblock (16px).
+// macroblock (16px). The stride is the number of bytes from one row to the
+// next, which is usually larger than the width.
 
 typedef struct {
 	unsigned int width;
 	unsigned int height;
+	unsigned int stride;
 	uint8_t *data;
 } plm_plane_t;
 
 
 // Decoded Video Frame
 // width and height denote the desired display size of the frame. This may be
-// different from the internal size of the 3 planes.
+// different from the internal size of the 3 planes. user is free for a frame
+// allocator to use; see plm_video_set_frame_allocator().
 
 typedef struct {
 	double time;
@@ -224,6 +241,7 @@ typedef struct {
 	plm_plane_t y;
 	plm_plane_t cr;
 	plm_plane_t cb;
+	void *user;
 } plm_frame_t;
 
 
@@ -266,6 +284,71 @@ typedef void(*plm_audio_decode_callback)
 typedef void(*plm_buffer_load_callback)(plm_buffer_t *self, void *user);
 
 
+// Callback function for plm_buffer when it's done with a chunk
+
+typedef void(*plm_buffer_release_callback)(plm_buffer_t *self, void *user);
+
+
+// Callback functions for plm_video to allocate and release frames
+
+typedef void(*plm_video_alloc_frame_callback)
+	(plm_video_t *self, plm_frame_t *frame, void *user);
+typedef void(*plm_video_release_frame_callback)
+	(plm_video_t *self, plm_frame_t *frame, void *user);
+
+
+// Stream information found by plm_probe_*(). The has_* fields tell which
+// headers were found; the fields after each are 0 otherwise. Bitrates are in
+// bits per second; a video bitrate of 0 means variable. gop_time is the time
+// code of the first group of pictures, in seconds.
+
+typedef struct {
+	int has_system_header;
+	int num_video_streams;
+	int num_audio_streams;
+
+	int has_sequence_header;
+	int width;
+	int height;
+	double framerate;
+	int video_bitrate;
+
+	int has_gop_header;
+	double gop_time;
+	int closed_gop;
+
+	int has_audio_header;
+	int samplerate;
+	int channels;
+	int audio_bitrate;
+} plm_info_t;
+
+
+// Profiling counters of a PLM_PROFILE build, for each stage of decoding: the
+// time spent in it, in time stamp counter cycles on x86 with GCC or Clang and
+// in nanoseconds elsewhere, and how often it ran. Stages nest; whole pictures
+// include the VLC, IDCT and MC stages, and start code scans are counted in
+// the stage that does them as well. With several video threads, each thread
+// adds the time it spent.
+
+#ifdef PLM_PROFILE
+	#define PLM_PROFILE_START_CODE 0 // Start code scans of all buffers
+	#define PLM_PROFILE_DEMUX 1 // plm_demux_decode()
+	#define PLM_PROFILE_VIDEO 2 // Whole video pictures
+	#define PLM_PROFILE_VIDEO_VLC 3 // Decoding and dequantizing coefficients
+	#define PLM_PROFILE_VIDEO_IDCT 4 // IDCT of blocks and adding the prediction
+	#define PLM_PROFILE_VIDEO_MC 5 // Motion compensation of macroblocks
+	#define PLM_PROFILE_AUDIO 6 // Whole audio frames
+	#define PLM_PROFILE_CONVERT 7 // plm_frame_to_*()
+	#define PLM_PROFILE_STAGES 8
+
+	typedef struct {
+		uint64_t ticks[PLM_PROFILE_STAGES];
+		uint64_t calls[PLM_PROFILE_STAGES];
+	} plm_profile_t;
+#endif
+
+
 
 // -----------------------------------------------------------------------------
 // plm_* public API
@@ -335,6 +418,35 @@ int plm_get_height(plm_t *self);
 double plm_get_framerate(plm_t *self);
 
 
+// Get or set thumbnail mode. When enabled, only the I-pictures of the video are
+// decoded, at 1/8 of the video size, from nothing but the DC coefficient of
+// each block; see plm_video_set_scale() and plm_video_set_skip_mode(). This is
+// meant for preview strips and thumbnails, and with audio disabled, gets
+// through a whole movie many times faster than decoding it. plm_get_width()
+// and plm_get_height() report the reduced size. This has to be set before the
+// first frame is decoded. Default FALSE.
+
+int plm_get_thumbnail_mode(plm_t *self);
+void plm_set_thumbnail_mode(plm_t *self, int enabled);
+
+
+// Get or set decoding ahead. With a queue size above 0, a background thread
+// demuxes and decodes up to that many video frames, and twice as many audio
+// frames, before they are asked for. plm_decode(), plm_decode_video() and
+// plm_decode_audio() then take them from the queue, and only wait for the
+// thread when it has fallen behind, so the cost of single frames (I-pictures
+// take much longer than B-pictures) is evened out. The frames are copies, so
+// this costs some memory bandwidth. Only for sources that load their own
+// data, like files and memory; not for a buffer that is written to while
+// decoding. Changing any other setting, rewinding or seeking pauses the
+// thread until the next decode call. Changing the queue size drops what was
+// decoded ahead, so set it before decoding or before a seek. Needs
+// threads (PLM_THREADS); otherwise this has no effect. Default 0.
+
+int plm_get_decode_ahead(plm_t *self);
+void plm_set_decode_ahead(plm_t *self, int frames);
+
+
 // Get or set whether audio decoding is enabled. Default TRUE.
 
 int plm_get_audio_enabled(plm_t *self);
@@ -455,6 +567,14 @@ int plm_seek(plm_t *self, double time, int seek_exact);
 plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 
 
+// Get the profiling counters of the demuxer and both decoders added together,
+// and reset them. Only available with PLM_PROFILE defined.
+
+#ifdef PLM_PROFILE
+	plm_profile_t plm_get_profile(plm_t *self);
+#endif
+
+
 
 // -----------------------------------------------------------------------------
 // plm_buffer public API
@@ -490,6 +610,9 @@ plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int f
 
 // Create an empty buffer with an initial capacity. The buffer will grow
 // as needed. Data that has already been read, will be discarded.
+// This is a ring buffer: data is never moved once written, and the buffer
+// only grows when more than the capacity is unread at once. Note that it
+// allocates twice the capacity.
 
 plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity);
 
@@ -502,6 +625,15 @@ plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity);
 plm_buffer_t *plm_buffer_create_for_appending(size_t initial_capacity);
 
 
+// Create an empty buffer that reads from chunks of memory owned by the caller,
+// without copying them; see plm_buffer_write_chunk(). Data that has already
+// been read, will be released. Only a few bytes around the boundaries of the
+// chunks are copied. This can only be used with the video decoder; not with
+// the demuxer or the audio decoder.
+
+plm_buffer_t *plm_buffer_create_with_chunks(void);
+
+
 // Destroy a buffer instance and free all data
 
 void plm_buffer_destroy(plm_buffer_t *self);
@@ -516,6 +648,18 @@ void plm_buffer_destroy(plm_buffer_t *self);
 size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length);
 
 
+// Append a chunk of memory to a _with_chunks buffer. The bytes are not copied,
+// and must stay valid until the release callback is called; that happens once
+// they have all been read, or when the buffer is rewound or destroyed. The
+// callback may be NULL. Returns the number of bytes added, which is 0 for
+// buffers of any other kind; the callback is not called then.
+
+size_t plm_buffer_write_chunk(
+	plm_buffer_t *self, const uint8_t *bytes, size_t length,
+	plm_buffer_release_callback fp, void *user
+);
+
+
 // Mark the current byte length as the end of this buffer and signal that no 
 // more data is expected to be written to it. This function should be called
 // just after the last plm_buffer_write().
@@ -636,6 +780,14 @@ double plm_demux_get_duration(plm_demux_t *self, int type);
 plm_packet_t *plm_demux_decode(plm_demux_t *self);
 
 
+// Get and reset the profiling counters of the demuxer and its buffer. Only
+// available with PLM_PROFILE defined.
+
+#ifdef PLM_PROFILE
+	plm_profile_t plm_demux_get_profile(plm_demux_t *self);
+#endif
+
+
 
 // -----------------------------------------------------------------------------
 // plm_video public API
@@ -663,7 +815,8 @@ int plm_video_has_header(plm_video_t *self);
 double plm_video_get_framerate(plm_video_t *self);
 
 
-// Get the display width/height.
+// Get the display width/height. With a scale set, this is the size of the
+// decoded frames, rounded up.
 
 int plm_video_get_width(plm_video_t *self);
 int plm_video_get_height(plm_video_t *self);
@@ -676,6 +829,82 @@ int plm_video_get_height(plm_video_t *self);
 void plm_video_set_no_delay(plm_video_t *self, int no_delay);
 
 
+// Set the number of threads used for decoding, including the calling thread.
+// The slices of a picture are decoded in parallel, and so are consecutive
+// B-pictures (up to one per thread) once they are complete in the buffer.
+// Frames are still returned in display order. The default is 1. Has no effect
+// if the library was built without thread support.
+
+void plm_video_set_threads(plm_video_t *self, int threads);
+
+
+// Decode at a reduced resolution of 1/scale of the video size, where scale is
+// 1, 2, 4 or 8. Only the low frequency coefficients of each block are used,
+// and motion vectors are scaled down, so this is much faster than decoding the
+// full picture and scaling it afterwards. At 8, each block is reduced to its
+// DC coefficient and no IDCT is done at all. Since the reference pictures lose
+// detail too, P- and B-pictures drift a bit until the next I-picture. The
+// default is 1. Changing it once decoding has started drops the frames decoded
+// so far, and skips pictures up to the next I-picture, as their references
+// are gone.
+
+void plm_video_set_scale(plm_video_t *self, int scale);
+
+
+// Set which pictures to skip, to catch up when decoding falls behind. Skipped
+// pictures are only parsed up to the start code of the next picture, and no
+// frame is returned for them; the time still advances as if they had been, so
+// the returned frames keep their timestamps. Pictures that reference a skipped
+// picture are skipped too, so after switching back to PLM_VIDEO_SKIP_NONE,
+// P-pictures are only decoded again from the next I-picture on. The default
+// is PLM_VIDEO_SKIP_NONE.
+
+#define PLM_VIDEO_SKIP_NONE 0 // Decode every picture
+#define PLM_VIDEO_SKIP_B 1 // Skip B-pictures, which no other picture references
+#define PLM_VIDEO_SKIP_NON_INTRA 2 // Only decode I-pictures
+
+void plm_video_set_skip_mode(plm_video_t *self, int skip_mode);
+
+
+// Get or set two-pass decoding. When enabled, the macroblocks of each slice
+// are parsed into a batch of records first, with their motion vectors and
+// coefficients, and then predicted and reconstructed in one go, which keeps
+// the bitstream parser apart from the IDCT and motion compensation. The
+// output is the same either way. Default FALSE.
+
+int plm_video_get_two_pass(plm_video_t *self);
+void plm_video_set_two_pass(plm_video_t *self, int enabled);
+
+
+// Get or set incremental decoding. Normally a picture is only decoded once
+// the start code of the next one is in the buffer, to be sure it's complete.
+// When enabled, pictures are decoded macroblock by macroblock as the data
+// arrives instead; plm_video_decode() returns NULL when it runs out, and
+// carries on after the next plm_buffer_write(). On pushed streams this spreads
+// the work over the writes rather than doing a whole picture at once, and a
+// frame is ready as soon as its last macroblock arrives. Pictures are then
+// decoded on the calling thread only. Default FALSE.
+
+int plm_video_get_incremental(plm_video_t *self);
+void plm_video_set_incremental(plm_video_t *self, int enabled);
+
+
+// Decode into frames allocated by the caller, instead of the three frames the
+// decoder owns. alloc gets a frame with the size of each plane filled in and
+// the stride set to the width. It has to set the data of each plane, with room
+// for stride * height bytes, and may raise the strides; all frames must have
+// the same strides though. Every picture is decoded into a new frame. The
+// decoder never writes to a frame after returning it, and calls release once
+// it no longer returns or references it. To keep a frame for longer, count the
+// references to it in the user field. This has to be set before the first
+// frame is decoded.
+
+void plm_video_set_frame_allocator(
+	plm_video_t *self, plm_video_alloc_frame_callback alloc,
+	plm_video_release_frame_callback release, void *user
+);
+
+
 // Get the current internal time in seconds.
 
 double plm_video_get_time(plm_video_t *self);
@@ -710,7 +939,10 @@ plm_frame_t *plm_video_decode(plm_video_t *self);
 // bytes from one line to the next. The stride must be at least 
 // (frame->width * bytes_per_pixel). The buffer pointed to by *dest must have a
 // size of at least (stride * frame->height).
+// A negative stride writes the image bottom-up, like a DIB; *dest is still
+// where the top line goes, which then is the last one in memory.
 // Note that the alpha component of the dest buffer is always left untouched.
+// These use SSE2 or AVX2 where available, with the same results.
 
 void plm_frame_to_rgb(plm_frame_t *frame, uint8_t *dest, int stride);
 void plm_frame_to_bgr(plm_frame_t *frame, uint8_t *dest, int stride);
@@ -720,6 +952,51 @@ void plm_frame_to_argb(plm_frame_t *frame, uint8_t *dest, int stride);
 void plm_frame_to_abgr(plm_frame_t *frame, uint8_t *dest, int stride);
 
 
+// Copy the YCrCb data of a frame into other YUV 4:2:0 or 4:2:2 layouts. The
+// chroma planes are half the size of the luma plane in each direction, rounded
+// up; frames with an odd width or height get their last chroma sample too.
+
+// Planar Y, U and V with an own pointer and stride for each plane. The luma
+// stride must be at least frame->width, the chroma strides at least
+// (frame->width + 1) / 2.
+
+void plm_frame_to_yuv420p(
+	plm_frame_t *frame, uint8_t *y, int y_stride,
+	uint8_t *u, int u_stride, uint8_t *v, int v_stride
+);
+
+// The same, as a single buffer: the Y plane with the given stride, followed by
+// U then V (I420) or V then U (YV12), each with stride / 2. The stride must be
+// even and at least frame->width rounded up to even. The buffer pointed to by
+// *dest must have a size of at least (stride * (frame->height +
+// (frame->height + 1) / 2)).
+
+void plm_frame_to_i420(plm_frame_t *frame, uint8_t *dest, int stride);
+void plm_frame_to_yv12(plm_frame_t *frame, uint8_t *dest, int stride);
+
+// The Y plane followed by a plane of interleaved U and V, both with the given
+// stride. Stride and size requirements are as for I420.
+
+void plm_frame_to_nv12(plm_frame_t *frame, uint8_t *dest, int stride);
+
+// Packed Y0 U Y1 V for each pair of pixels; chroma lines are used twice. The
+// stride must be at least (frame->width rounded up to even * 2) and may be
+// negative, as for the RGB functions. The buffer pointed to by *dest must have
+// a size of at least (stride * frame->height).
+
+void plm_frame_to_yuy2(plm_frame_t *frame, uint8_t *dest, int stride);
+
+
+// Get and reset the profiling counters of the video decoder and its buffer.
+// These also include the frame conversions above, which aren't tied to a
+// decoder and are counted without locking; convert on one thread at a time
+// for exact numbers. Only available with PLM_PROFILE defined.
+
+#ifdef PLM_PROFILE
+	plm_profile_t plm_video_get_profile(plm_video_t *self);
+#endif
+
+
 // -----------------------------------------------------------------------------
 // plm_audio public API
 // Decode MPEG-1 Audio Layer II ("mp2") data into raw samples
@@ -776,6 +1053,35 @@ int plm_audio_has_ended(plm_audio_t *self);
 plm_samples_t *plm_audio_decode(plm_audio_t *self);
 
 
+// Get and reset the profiling counters of the audio decoder and its buffer.
+// Only available with PLM_PROFILE defined.
+
+#ifdef PLM_PROFILE
+	plm_profile_t plm_audio_get_profile(plm_audio_t *self);
+#endif
+
+
+
+// -----------------------------------------------------------------------------
+// plm_probe public API
+// Read the stream headers from a few bytes of data, without setting up the
+// demuxer or decoders. These don't allocate any memory.
+
+
+// Find the first sequence header in MPEG-1 video data, and the GOP header
+// following it, if present. Returns TRUE if a sequence header was found.
+
+int plm_probe_sequence_header(const uint8_t *bytes, size_t length, plm_info_t *info);
+
+
+// Read the headers from the start of an MPEG-PS file, or of raw MPEG-1 video
+// or MP2 audio. For MPEG-PS, this goes through the packets until the first
+// video and audio headers have been found; it needs the complete packets.
+// Returns TRUE if a video or audio header was found.
+
+int plm_probe_stream(const uint8_t *bytes, size_t length, plm_info_t *info);
+
+
 
 #ifdef __cplusplus
 }
@@ -803,16 +1109,107 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self);
 
 #define PLM_UNUSED(expr) (void)(expr)
 
+// SIMD kernels are compiled with per-function target attributes, so that the
+// library still builds with the compiler's default flags (e.g. i386 without 
+// -msse2). The actual kernel is chosen at runtime via plm_cpu_has_*().
+
+#if !defined(PLM_NO_SIMD) && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	#define PLM_SIMD_X86
+	#include <immintrin.h>
+	#define PLM_TARGET_SSE2 __attribute__((target("sse2")))
+	#define PLM_TARGET_AVX2 __attribute__((target("avx2")))
+
+	static int plm_cpu_has_sse2(void) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	}
+
+	static int plm_cpu_has_avx2(void) {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+
+#if !defined(PLM_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+	#define PLM_THREADS
+	#include <pthread.h>
+#endif
+
+// PLM_PROFILE_BEGIN() starts a stopwatch; each PLM_PROFILE_END() adds the time
+// since then to a stage and restarts it, so one stage can follow another.
+
+#ifdef PLM_PROFILE
+	#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+		#include <x86intrin.h>
+
+		static inline uint64_t plm_profile_ticks(void) {
+			return __rdtsc();
+		}
+	#else
+		#include <time.h>
+
+		static inline uint64_t plm_profile_ticks(void) {
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		}
+	#endif
+
+	#define PLM_PROFILE_BEGIN(NAME) uint64_t NAME = plm_profile_ticks()
+	#define PLM_PROFILE_END(PROFILE, STAGE, NAME) do { \
+		uint64_t plm_profile_now = plm_profile_ticks(); \
+		(PROFILE)->ticks[STAGE] += plm_profile_now - (NAME); \
+		(PROFILE)->calls[STAGE]++; \
+		NAME = plm_profile_now; \
+	} while (0)
+
+	static void plm_profile_add(plm_profile_t *self, const plm_profile_t *other) {
+		for (int i = 0; i < PLM_PROFILE_STAGES; i++) {
+			self->ticks[i] += other->ticks[i];
+			self->calls[i] += other->calls[i];
+		}
+	}
+
+	// Frame conversions have no decoder to count in
+	static plm_profile_t plm_frame_profile;
+#else
+	#define PLM_PROFILE_BEGIN(NAME)
+	#define PLM_PROFILE_END(PROFILE, STAGE, NAME)
+#endif
+
 
 // -----------------------------------------------------------------------------
 // plm (high-level interface) implementation
 
+// A queue of frames decoded ahead, with a single producer and consumer. The
+// counters only grow; the slot of a frame is its counter modulo the size. The
+// consumer keeps the frame it took until it asks for the next one (held).
+// Each slot also has the decoder's time from before that frame was decoded,
+// which is what plm_decode() goes by, and whether decoding succeeded; a
+// failed decode only ends the stream if the demuxer has ended, and the slot
+// at write then has the time of that decode.
+
+typedef struct {
+	double time;
+	int decoded;
+} plm_ahead_slot_t;
+
+typedef struct {
+	int size;
+	int read;
+	int write;
+	int held;
+	int ended;
+	plm_ahead_slot_t *slots;
+} plm_ahead_queue_t;
+
 struct plm_t {
 	plm_demux_t *demux;
 	double time;
 	int has_ended;
 	int loop;
 	int has_decoders;
+	int thumbnail_mode;
 
 	int video_enabled;
 	int video_packet_type;
@@ -831,14 +1228,40 @@ struct plm_t {
 
 	plm_audio_decode_callback audio_decode_callback;
 	void *audio_decode_callback_user_data;
+
+	#ifdef PLM_THREADS
+		int decode_ahead;
+		pthread_t ahead_thread;
+		pthread_mutex_t ahead_lock;
+		pthread_cond_t ahead_ready;
+		pthread_cond_t ahead_space;
+		int ahead_running;
+		int ahead_exit;
+		plm_ahead_queue_t ahead_video;
+		plm_ahead_queue_t ahead_audio;
+		plm_frame_t *ahead_frames;
+		plm_samples_t *ahead_samples;
+	#endif
 };
 
 int plm_init_decoders(plm_t *self);
+void plm_init_thumbnail_mode(plm_t *self);
 void plm_handle_end(plm_t *self);
 void plm_read_video_packet(plm_buffer_t *buffer, void *user);
 void plm_read_audio_packet(plm_buffer_t *buffer, void *user);
 void plm_read_packets(plm_t *self, int requested_type);
 
+#ifdef PLM_THREADS
+	int plm_start_ahead(plm_t *self);
+	void plm_stop_ahead(plm_t *self);
+	void plm_clear_ahead(plm_ahead_queue_t *queue);
+	void *plm_ahead_main(void *user);
+	void plm_ahead_copy_frame(plm_frame_t *dest, plm_frame_t *src);
+	int plm_ahead_next(plm_t *self, plm_ahead_queue_t *queue);
+	void plm_ahead_release(plm_t *self, plm_ahead_queue_t *queue);
+	void plm_decode_ahead(plm_t *self, double tick);
+#endif
+
 plm_t *plm_create_with_filename(const char *filename) {
 	plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
 	if (!buffer) {
@@ -896,6 +1319,7 @@ int plm_init_decoders(plm_t *self) {
 
 	if (self->video_buffer) {
 		self->video_decoder = plm_video_create_with_buffer(self->video_buffer, TRUE);
+		plm_init_thumbnail_mode(self);
 	}
 
 	if (self->audio_buffer) {
@@ -907,6 +1331,7 @@ int plm_init_decoders(plm_t *self) {
 }
 
 void plm_destroy(plm_t *self) {
+	plm_set_decode_ahead(self, 0);
 	if (self->video_decoder) {
 		plm_video_destroy(self->video_decoder);
 	}
@@ -942,6 +1367,12 @@ int plm_has_headers(plm_t *self) {
 }
 
 void plm_set_audio_enabled(plm_t *self, int enabled) {
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+		if (enabled != self->audio_enabled) {
+			plm_clear_ahead(&self->ahead_audio);
+		}
+	#endif
 	self->audio_enabled = enabled;
 
 	if (!enabled) {
@@ -958,6 +1389,12 @@ void plm_set_audio_stream(plm_t *self, int stream_index) {
 	if (stream_index < 0 || stream_index > 3) {
 		return;
 	}
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+		if (stream_index != self->audio_stream_index) {
+			plm_clear_ahead(&self->ahead_audio);
+		}
+	#endif
 	self->audio_stream_index = stream_index;
 
 	// Set the correct audio_packet_type
@@ -969,6 +1406,12 @@ int plm_get_video_enabled(plm_t *self) {
 }
 
 void plm_set_video_enabled(plm_t *self, int enabled) {
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+		if (enabled != self->video_enabled) {
+			plm_clear_ahead(&self->ahead_video);
+		}
+	#endif
 	self->video_enabled = enabled;
 
 	if (!enabled) {
@@ -981,6 +1424,78 @@ void plm_set_video_enabled(plm_t *self, int enabled) {
 		: 0;
 }
 
+int plm_get_decode_ahead(plm_t *self) {
+	#ifdef PLM_THREADS
+		return self->decode_ahead;
+	#else
+		PLM_UNUSED(self);
+		return 0;
+	#endif
+}
+
+void plm_set_decode_ahead(plm_t *self, int frames) {
+	#ifdef PLM_THREADS
+		if (self->decode_ahead) {
+			plm_stop_ahead(self);
+			pthread_cond_destroy(&self->ahead_space);
+			pthread_cond_destroy(&self->ahead_ready);
+			pthread_mutex_destroy(&self->ahead_lock);
+			for (int i = 0; i < self->ahead_video.size; i++) {
+				free(self->ahead_frames[i].y.data);
+			}
+			free(self->ahead_frames);
+			free(self->ahead_samples);
+			free(self->ahead_video.slots);
+			free(self->ahead_audio.slots);
+			memset(&self->ahead_video, 0, sizeof(plm_ahead_queue_t));
+			memset(&self->ahead_audio, 0, sizeof(plm_ahead_queue_t));
+			self->ahead_frames = NULL;
+			self->ahead_samples = NULL;
+			self->decode_ahead = 0;
+		}
+		if (frames <= 0) {
+			return;
+		}
+
+		pthread_mutex_init(&self->ahead_lock, NULL);
+		pthread_cond_init(&self->ahead_ready, NULL);
+		pthread_cond_init(&self->ahead_space, NULL);
+		self->ahead_video.size = frames;
+		self->ahead_audio.size = frames * 2;
+		self->ahead_frames = (plm_frame_t *)calloc(self->ahead_video.size, sizeof(plm_frame_t));
+		self->ahead_samples = (plm_samples_t *)calloc(self->ahead_audio.size, sizeof(plm_samples_t));
+		self->ahead_video.slots = (plm_ahead_slot_t *)calloc(self->ahead_video.size, sizeof(plm_ahead_slot_t));
+		self->ahead_audio.slots = (plm_ahead_slot_t *)calloc(self->ahead_audio.size, sizeof(plm_ahead_slot_t));
+		self->decode_ahead = frames;
+	#else
+		PLM_UNUSED(self);
+		PLM_UNUSED(frames);
+	#endif
+}
+
+int plm_get_thumbnail_mode(plm_t *self) {
+	return self->thumbnail_mode;
+}
+
+void plm_set_thumbnail_mode(plm_t *self, int enabled) {
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+		if (enabled != self->thumbnail_mode) {
+			plm_clear_ahead(&self->ahead_video);
+		}
+	#endif
+	self->thumbnail_mode = enabled;
+	if (self->video_decoder) {
+		plm_init_thumbnail_mode(self);
+	}
+}
+
+void plm_init_thumbnail_mode(plm_t *self) {
+	int enabled = self->thumbnail_mode;
+	plm_video_set_scale(self->video_decoder, enabled ? 8 : 1);
+	plm_video_set_skip_mode(self->video_decoder, enabled ? PLM_VIDEO_SKIP_NON_INTRA : PLM_VIDEO_SKIP_NONE);
+}
+
 int plm_get_num_video_streams(plm_t *self) {
 	return plm_demux_get_num_video_streams(self->demux);
 }
@@ -1026,10 +1541,19 @@ double plm_get_time(plm_t *self) {
 }
 
 double plm_get_duration(plm_t *self) {
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+	#endif
 	return plm_demux_get_duration(self->demux, PLM_DEMUX_PACKET_VIDEO_1);
 }
 
 void plm_rewind(plm_t *self) {
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+		plm_clear_ahead(&self->ahead_video);
+		plm_clear_ahead(&self->ahead_audio);
+	#endif
+
 	if (self->video_decoder) {
 		plm_video_rewind(self->video_decoder);
 	}
@@ -1069,6 +1593,13 @@ void plm_decode(plm_t *self, double tick) {
 		return;
 	}
 
+	#ifdef PLM_THREADS
+		if (self->decode_ahead) {
+			plm_decode_ahead(self, tick);
+			return;
+		}
+	#endif
+
 	int decode_video = (self->video_decode_callback && self->video_packet_type);
 	int decode_audio = (self->audio_decode_callback && self->audio_packet_type);
 
@@ -1132,7 +1663,27 @@ plm_frame_t *plm_decode_video(plm_t *self) {
 		return NULL;
 	}
 
-	plm_frame_t *frame = plm_video_decode(self->video_decoder);
+	plm_frame_t *frame = NULL;
+	#ifdef PLM_THREADS
+		if (self->decode_ahead) {
+			plm_ahead_release(self, &self->ahead_video);
+			int slot = plm_ahead_next(self, &self->ahead_video);
+			if (slot >= 0) {
+				self->ahead_video.held = TRUE;
+				if (self->ahead_video.slots[slot].decoded) {
+					frame = &self->ahead_frames[slot];
+				}
+			}
+			if (!frame) {
+				plm_stop_ahead(self); // before looking at the demuxer
+			}
+		}
+		else {
+			frame = plm_video_decode(self->video_decoder);
+		}
+	#else
+		frame = plm_video_decode(self->video_decoder);
+	#endif
 	if (frame) {
 		self->time = frame->time;
 	}
@@ -1151,7 +1702,27 @@ plm_samples_t *plm_decode_audio(plm_t *self) {
 		return NULL;
 	}
 
-	plm_samples_t *samples = plm_audio_decode(self->audio_decoder);
+	plm_samples_t *samples = NULL;
+	#ifdef PLM_THREADS
+		if (self->decode_ahead) {
+			plm_ahead_release(self, &self->ahead_audio);
+			int slot = plm_ahead_next(self, &self->ahead_audio);
+			if (slot >= 0) {
+				self->ahead_audio.held = TRUE;
+				if (self->ahead_audio.slots[slot].decoded) {
+					samples = &self->ahead_samples[slot];
+				}
+			}
+			if (!samples) {
+				plm_stop_ahead(self); // before looking at the demuxer
+			}
+		}
+		else {
+			samples = plm_audio_decode(self->audio_decoder);
+		}
+	#else
+		samples = plm_audio_decode(self->audio_decoder);
+	#endif
 	if (samples) {
 		self->time = samples->time;
 	}
@@ -1207,66 +1778,340 @@ void plm_read_packets(plm_t *self, int requested_type) {
 	}
 }
 
-plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
-	if (!plm_init_decoders(self)) {
-		return NULL;
-	}
+#ifdef PLM_THREADS
 
-	if (!self->video_packet_type) {
-		return NULL;
+// Start the decode-ahead thread, unless it's running already. The decoders
+// and the demuxer belong to it until plm_stop_ahead().
+
+int plm_start_ahead(plm_t *self) {
+	if (self->ahead_running) {
+		return TRUE;
+	}
+	if (!plm_has_headers(self)) {
+		return FALSE;
 	}
 
-	int type = self->video_packet_type;
+	self->ahead_exit = FALSE;
+	if (pthread_create(&self->ahead_thread, NULL, plm_ahead_main, self) != 0) {
+		return FALSE;
+	}
+	self->ahead_running = TRUE;
+	return TRUE;
+}
 
-	double start_time = plm_demux_get_start_time(self->demux, type);
-	double duration = plm_demux_get_duration(self->demux, type);
+// Stop the decode-ahead thread. What it has decoded stays in the queues.
 
-	if (time < 0) {
-		time = 0;
-	}
-	else if (time > duration) {
-		time = duration;
-	}
-	
-	plm_packet_t *packet = plm_demux_seek(self->demux, time, type, TRUE);
-	if (!packet) {
-		return NULL;
+void plm_stop_ahead(plm_t *self) {
+	if (!self->ahead_running) {
+		return;
 	}
 
-	// Disable writing to the audio buffer while decoding video
-	int previous_audio_packet_type = self->audio_packet_type;
-	self->audio_packet_type = 0;
+	pthread_mutex_lock(&self->ahead_lock);
+	self->ahead_exit = TRUE;
+	pthread_cond_signal(&self->ahead_space);
+	pthread_mutex_unlock(&self->ahead_lock);
 
-	// Clear video buffer and decode the found packet
-	plm_video_rewind(self->video_decoder);
-	plm_video_set_time(self->video_decoder, packet->pts - start_time);
-	plm_buffer_write(self->video_buffer, packet->data, packet->length);
-	plm_frame_t *frame = plm_video_decode(self->video_decoder);	
+	pthread_join(self->ahead_thread, NULL);
+	self->ahead_running = FALSE;
+}
 
-	// If we want to seek to an exact frame, we have to decode all frames
-	// on top of the intra frame we just jumped to.
-	if (seek_exact) {
-		while (frame && frame->time < time) {
-			frame = plm_video_decode(self->video_decoder);
+void plm_clear_ahead(plm_ahead_queue_t *queue) {
+	queue->read = 0;
+	queue->write = 0;
+	queue->held = FALSE;
+	queue->ended = FALSE;
+}
+
+void *plm_ahead_main(void *user) {
+	plm_t *self = (plm_t *)user;
+
+	pthread_mutex_lock(&self->ahead_lock);
+	while (!self->ahead_exit) {
+		plm_ahead_queue_t *video = &self->ahead_video;
+		plm_ahead_queue_t *audio = &self->ahead_audio;
+		int decode_video = self->video_packet_type && !video->ended;
+		int decode_audio = self->audio_packet_type && !audio->ended;
+		if (!decode_video && !decode_audio) {
+			break;
 		}
-	}
 
-	// Enable writing to the audio buffer again?
-	self->audio_packet_type = previous_audio_packet_type;
+		// Wait for room; while there is for both, keep them level in time
+		decode_video = decode_video && video->write - video->read < video->size;
+		decode_audio = decode_audio && audio->write - audio->read < audio->size;
+		if (decode_video && decode_audio) {
+			decode_audio =
+				plm_audio_get_time(self->audio_decoder) <
+				plm_video_get_time(self->video_decoder);
+			decode_video = !decode_audio;
+		}
+		if (!decode_video && !decode_audio) {
+			pthread_cond_wait(&self->ahead_space, &self->ahead_lock);
+			continue;
+		}
+		pthread_mutex_unlock(&self->ahead_lock);
 
-	if (frame) {
-		self->time = frame->time;
-	}
+		// The consumer doesn't touch the slot at write until it's counted
+		plm_ahead_queue_t *queue = decode_video ? video : audio;
+		plm_ahead_slot_t *slot = &queue->slots[queue->write % queue->size];
+		if (decode_video) {
+			slot->time = plm_video_get_time(self->video_decoder);
+			plm_frame_t *frame = plm_video_decode(self->video_decoder);
+			if (frame) {
+				plm_ahead_copy_frame(&self->ahead_frames[queue->write % queue->size], frame);
+			}
+			slot->decoded = (frame != NULL);
+		}
+		else {
+			slot->time = plm_audio_get_time(self->audio_decoder);
+			plm_samples_t *samples = plm_audio_decode(self->audio_decoder);
+			if (samples) {
+				self->ahead_samples[queue->write % queue->size] = *samples;
+			}
+			slot->decoded = (samples != NULL);
+		}
+		int ended = !slot->decoded && plm_demux_has_ended(self->demux);
 
-	self->has_ended = FALSE;
-	return frame;
+		pthread_mutex_lock(&self->ahead_lock);
+		if (ended) {
+			queue->ended = TRUE;
+		}
+		else {
+			queue->write++;
+		}
+		pthread_cond_signal(&self->ahead_ready);
+	}
+	pthread_mutex_unlock(&self->ahead_lock);
+	return NULL;
 }
 
-int plm_seek(plm_t *self, double time, int seek_exact) {
-	plm_frame_t *frame = plm_seek_frame(self, time, seek_exact);
-	
-	if (!frame) {
-		return FALSE;
+// Copy a decoded frame into a queue slot, which gets memory for the planes
+// the first time. The planes are copied without their padding.
+
+void plm_ahead_copy_frame(plm_frame_t *dest, plm_frame_t *src) {
+	size_t luma_size = src->y.width * src->y.height;
+	size_t chroma_size = src->cr.width * src->cr.height;
+	if (!dest->y.data || dest->y.width != src->y.width || dest->y.height != src->y.height) {
+		free(dest->y.data);
+		dest->y.data = (uint8_t *)malloc(luma_size + chroma_size * 2);
+	}
+
+	uint8_t *data = dest->y.data;
+	plm_plane_t *planes[] = {&src->y, &src->cr, &src->cb};
+	plm_plane_t *dest_planes[] = {&dest->y, &dest->cr, &dest->cb};
+	for (int i = 0; i < 3; i++) {
+		plm_plane_t *plane = planes[i];
+		plm_plane_t *dest_plane = dest_planes[i];
+		dest_plane->width = plane->width;
+		dest_plane->height = plane->height;
+		dest_plane->stride = plane->width;
+		dest_plane->data = data;
+		for (unsigned int row = 0; row < plane->height; row++) {
+			memcpy(data, plane->data + row * plane->stride, plane->width);
+			data += plane->width;
+		}
+	}
+
+	dest->time = src->time;
+	dest->width = src->width;
+	dest->height = src->height;
+	dest->user = NULL;
+}
+
+// Wait for the next item of a queue, and return its slot, or -1 once the
+// stream has ended. The item may be a failed decode. Starts the thread if it
+// isn't running.
+
+int plm_ahead_next(plm_t *self, plm_ahead_queue_t *queue) {
+	if (
+		!self->ahead_running &&
+		queue->read == queue->write && !queue->ended &&
+		!plm_start_ahead(self)
+	) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&self->ahead_lock);
+	while (queue->read == queue->write && !queue->ended && self->ahead_running) {
+		pthread_cond_wait(&self->ahead_ready, &self->ahead_lock);
+	}
+	int slot = queue->read != queue->write
+		? queue->read % queue->size
+		: -1;
+	pthread_mutex_unlock(&self->ahead_lock);
+	return slot;
+}
+
+// Give the item the consumer took back to the thread.
+
+void plm_ahead_release(plm_t *self, plm_ahead_queue_t *queue) {
+	if (!queue->held) {
+		return;
+	}
+	pthread_mutex_lock(&self->ahead_lock);
+	queue->read++;
+	queue->held = FALSE;
+	pthread_cond_signal(&self->ahead_space);
+	pthread_mutex_unlock(&self->ahead_lock);
+}
+
+// plm_decode() with the frames decoded ahead; this takes frames from the
+// queues up to the time, the same way plm_decode() decodes them.
+
+void plm_decode_ahead(plm_t *self, double tick) {
+	int decode_video = (self->video_decode_callback && self->video_packet_type);
+	int decode_audio = (self->audio_decode_callback && self->audio_packet_type);
+
+	if (!decode_video && !decode_audio) {
+		// Nothing to do here
+		return;
+	}
+
+	int did_decode = FALSE;
+	int decode_video_failed = FALSE;
+	int decode_audio_failed = FALSE;
+
+	double video_target_time = self->time + tick;
+	double audio_target_time = self->time + tick + self->audio_lead_time;
+
+	plm_ahead_release(self, &self->ahead_video);
+	plm_ahead_release(self, &self->ahead_audio);
+	do {
+		did_decode = FALSE;
+
+		if (decode_video) {
+			plm_ahead_queue_t *queue = &self->ahead_video;
+			int slot = plm_ahead_next(self, queue);
+			if (queue->slots[queue->read % queue->size].time < video_target_time) {
+				if (slot >= 0 && queue->slots[slot].decoded) {
+					self->video_decode_callback(self, &self->ahead_frames[slot], self->video_decode_callback_user_data);
+					did_decode = TRUE;
+				}
+				else {
+					decode_video_failed = TRUE;
+				}
+				queue->held = (slot >= 0);
+				plm_ahead_release(self, queue);
+			}
+		}
+
+		if (decode_audio) {
+			plm_ahead_queue_t *queue = &self->ahead_audio;
+			int slot = plm_ahead_next(self, queue);
+			if (queue->slots[queue->read % queue->size].time < audio_target_time) {
+				if (slot >= 0 && queue->slots[slot].decoded) {
+					self->audio_decode_callback(self, &self->ahead_samples[slot], self->audio_decode_callback_user_data);
+					did_decode = TRUE;
+				}
+				else {
+					decode_audio_failed = TRUE;
+				}
+				queue->held = (slot >= 0);
+				plm_ahead_release(self, queue);
+			}
+		}
+	} while (did_decode);
+
+	// Did all sources we wanted to decode fail and the demuxer is at the end?
+	if (
+		(!decode_video || decode_video_failed) && 
+		(!decode_audio || decode_audio_failed)
+	) {
+		plm_stop_ahead(self);
+		if (plm_demux_has_ended(self->demux)) {
+			plm_handle_end(self);
+			return;
+		}
+	}
+
+	self->time += tick;
+}
+
+#endif // PLM_THREADS
+
+plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
+	if (!plm_init_decoders(self)) {
+		return NULL;
+	}
+
+	if (!self->video_packet_type) {
+		return NULL;
+	}
+
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+		plm_clear_ahead(&self->ahead_video);
+		plm_clear_ahead(&self->ahead_audio);
+	#endif
+
+	int type = self->video_packet_type;
+
+	double start_time = plm_demux_get_start_time(self->demux, type);
+	double duration = plm_demux_get_duration(self->demux, type);
+
+	if (time < 0) {
+		time = 0;
+	}
+	else if (time > duration) {
+		time = duration;
+	}
+	
+	plm_packet_t *packet = plm_demux_seek(self->demux, time, type, TRUE);
+	if (!packet) {
+		return NULL;
+	}
+
+	// Disable writing to the audio buffer while decoding video
+	int previous_audio_packet_type = self->audio_packet_type;
+	self->audio_packet_type = 0;
+
+	// Clear video buffer and decode the found packet
+	plm_video_rewind(self->video_decoder);
+	plm_video_set_time(self->video_decoder, packet->pts - start_time);
+	plm_buffer_write(self->video_buffer, packet->data, packet->length);
+	plm_frame_t *frame = plm_video_decode(self->video_decoder);	
+
+	// If we want to seek to an exact frame, we have to decode all frames
+	// on top of the intra frame we just jumped to.
+	if (seek_exact) {
+		while (frame && frame->time < time) {
+			frame = plm_video_decode(self->video_decoder);
+		}
+	}
+
+	// Enable writing to the audio buffer again?
+	self->audio_packet_type = previous_audio_packet_type;
+
+	if (frame) {
+		self->time = frame->time;
+	}
+
+	self->has_ended = FALSE;
+	return frame;
+}
+
+#ifdef PLM_PROFILE
+plm_profile_t plm_get_profile(plm_t *self) {
+	#ifdef PLM_THREADS
+		plm_stop_ahead(self);
+	#endif
+	plm_profile_t profile = plm_demux_get_profile(self->demux);
+	if (self->video_decoder) {
+		plm_profile_t video = plm_video_get_profile(self->video_decoder);
+		plm_profile_add(&profile, &video);
+	}
+	if (self->audio_decoder) {
+		plm_profile_t audio = plm_audio_get_profile(self->audio_decoder);
+		plm_profile_add(&profile, &audio);
+	}
+	return profile;
+}
+#endif
+
+int plm_seek(plm_t *self, double time, int seek_exact) {
+	plm_frame_t *frame = plm_seek_frame(self, time, seek_exact);
+	
+	if (!frame) {
+		return FALSE;
 	}
 
 	if (self->video_decode_callback) {
@@ -1313,9 +2158,33 @@ enum plm_buffer_mode {
 	PLM_BUFFER_MODE_FILE,
 	PLM_BUFFER_MODE_FIXED_MEM,
 	PLM_BUFFER_MODE_RING,
-	PLM_BUFFER_MODE_APPEND
+	PLM_BUFFER_MODE_APPEND,
+	PLM_BUFFER_MODE_CHUNKS
 };
 
+// Buffers that own their memory allocate this many bytes past the capacity,
+// so the bit reader can load a full 64-bit window anywhere in the data.
+
+#define PLM_BUFFER_PADDING 8
+
+typedef struct {
+	const uint8_t *bytes;
+	size_t length;
+	plm_buffer_release_callback release;
+	void *user;
+} plm_buffer_chunk_t;
+
+// The most a _with_chunks buffer copies at a chunk boundary. plm_buffer_has()
+// can't wait for more than this at once; the most the video decoder asks for
+// is a sequence header with quantizer matrices, at 136 bytes.
+
+#define PLM_BUFFER_BRIDGE_SIZE 256
+
+// Code for plm_buffer_find_start_code() and plm_buffer_has_start_code() that
+// matches any start code.
+
+#define PLM_BUFFER_ANY_START_CODE 0x100
+
 struct plm_buffer_t {
 	size_t bit_index;
 	size_t capacity;
@@ -1329,9 +2198,44 @@ struct plm_buffer_t {
 	plm_buffer_load_callback load_callback;
 	void *load_callback_user_data;
 	uint8_t *bytes;
+	size_t padding;
+	size_t start;
 	enum plm_buffer_mode mode;
+	size_t (*scan_start_code)(const uint8_t *bytes, size_t begin, size_t end);
+
+	// Where the last unsuccessful plm_buffer_has_start_code() for scan_code
+	// started and where it gave up, so the next one can continue from there.
+	int scan_code;
+	size_t scan_from_bit_index;
+	size_t scan_to_bit_index;
+
+	// _with_chunks buffers: the position of the first unreleased chunk is 0,
+	// and bytes/length are a view of the data starting at view_start. That is
+	// either one chunk, or a copy in bridge of the data across a boundary.
+	// All positions kept outside of the reader, such as the scan above, are
+	// relative to the first chunk; see plm_buffer_get_bit_position().
+	plm_buffer_chunk_t *chunks;
+	int chunks_len;
+	int chunks_capacity;
+	size_t chunks_size;
+	size_t view_start;
+	int view_chunk;
+	size_t view_chunk_start;
+	uint8_t bridge[PLM_BUFFER_BRIDGE_SIZE + PLM_BUFFER_PADDING];
+
+	#ifdef PLM_PROFILE
+		plm_profile_t profile;
+	#endif
 };
 
+// Ring buffers (_with_capacity and file buffers) hold the data from start to
+// length. They have room for twice the capacity, and positions past the
+// capacity are also written one capacity earlier. Once the read position
+// gets past the capacity, all positions are moved back by the capacity, and
+// reading continues in the first half. Therefore all data from start to
+// length is contiguous in memory, and the reader never has to deal with the
+// wrap-around.
+
 typedef struct {
 	int16_t index;
 	int16_t value;
@@ -1342,11 +2246,44 @@ typedef struct {
 	uint16_t value;
 } plm_vlc_uint_t;
 
+// First level of a VLC table, indexed by the next `bits` bits of the stream.
+// Codes up to that length are decoded in one lookup; length is then the code
+// length. For longer codes length is 0 and value is the index in the tree to
+// continue at, one bit at a time.
+
+typedef struct {
+	int16_t value;
+	int16_t length;
+} plm_vlc_lut_t;
+
+typedef struct {
+	uint16_t value;
+	int16_t length;
+} plm_vlc_uint_lut_t;
+
+typedef struct {
+	int bits;
+	const plm_vlc_lut_t *lut;
+	const plm_vlc_t *tree;
+} plm_vlc_table_t;
+
 
 void plm_buffer_seek(plm_buffer_t *self, size_t pos);
 size_t plm_buffer_tell(plm_buffer_t *self);
 void plm_buffer_discard_read_bytes(plm_buffer_t *self);
+void plm_buffer_rebase(plm_buffer_t *self, size_t count);
+int plm_buffer_is_ring(plm_buffer_t *self);
+void plm_buffer_grow_ring(plm_buffer_t *self, size_t count);
+void plm_buffer_mirror(plm_buffer_t *self, size_t from, size_t to);
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user);
+size_t plm_buffer_get_bit_position(plm_buffer_t *self);
+void plm_buffer_set_bit_position(plm_buffer_t *self, size_t pos);
+void plm_buffer_select_view(plm_buffer_t *self, size_t pos, size_t count);
+void plm_buffer_release_chunks(plm_buffer_t *self, int count);
+void plm_buffer_free_chunk(plm_buffer_t *self, void *user);
+void plm_buffer_init_kernels(plm_buffer_t *self);
+void plm_buffer_init_with_memory(plm_buffer_t *self, uint8_t *bytes, size_t length);
+size_t plm_buffer_scan_start_code(const uint8_t *bytes, size_t begin, size_t end);
 
 int plm_buffer_has(plm_buffer_t *self, size_t count);
 int plm_buffer_read(plm_buffer_t *self, int count);
@@ -1356,8 +2293,9 @@ int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v);
 int plm_buffer_next_start_code(plm_buffer_t *self);
 int plm_buffer_find_start_code(plm_buffer_t *self, int code);
 int plm_buffer_no_start_code(plm_buffer_t *self);
-int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table);
-uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table);
+int plm_buffer_peek(plm_buffer_t *self, int count);
+int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_table_t *table);
+uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_table_t *table);
 
 plm_buffer_t *plm_buffer_create_with_filename(const char *filename) {
 	FILE *fh = fopen(filename, "rb");
@@ -1384,15 +2322,24 @@ plm_buffer_t *plm_buffer_create_with_file(FILE *fh, int close_when_done) {
 
 plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int free_when_done) {
 	plm_buffer_t *self = (plm_buffer_t *)malloc(sizeof(plm_buffer_t));
+	plm_buffer_init_with_memory(self, bytes, length);
+	self->free_when_done = free_when_done;
+	return self;
+}
+
+// Set up a buffer that reads from memory, for buffers that aren't allocated
+// by plm_buffer_create_with_memory(); see plm_probe_stream()
+
+void plm_buffer_init_with_memory(plm_buffer_t *self, uint8_t *bytes, size_t length) {
 	memset(self, 0, sizeof(plm_buffer_t));
 	self->capacity = length;
 	self->length = length;
 	self->total_size = length;
-	self->free_when_done = free_when_done;
 	self->bytes = bytes;
 	self->mode = PLM_BUFFER_MODE_FIXED_MEM;
 	self->discard_read_bytes = FALSE;
-	return self;
+	self->scan_code = -1;
+	plm_buffer_init_kernels(self);
 }
 
 plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity) {
@@ -1400,9 +2347,12 @@ plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity) {
 	memset(self, 0, sizeof(plm_buffer_t));
 	self->capacity = capacity;
 	self->free_when_done = TRUE;
-	self->bytes = (uint8_t *)malloc(capacity);
+	self->bytes = (uint8_t *)malloc(capacity * 2 + PLM_BUFFER_PADDING);
+	self->padding = PLM_BUFFER_PADDING;
 	self->mode = PLM_BUFFER_MODE_RING;
 	self->discard_read_bytes = TRUE;
+	self->scan_code = -1;
+	plm_buffer_init_kernels(self);
 	return self;
 }
 
@@ -1410,6 +2360,21 @@ plm_buffer_t *plm_buffer_create_for_appending(size_t initial_capacity) {
 	plm_buffer_t *self = plm_buffer_create_with_capacity(initial_capacity);
 	self->mode = PLM_BUFFER_MODE_APPEND;
 	self->discard_read_bytes = FALSE;
+
+	// Not a ring; it doesn't need the second half
+	self->bytes = (uint8_t *)realloc(self->bytes, initial_capacity + PLM_BUFFER_PADDING);
+	return self;
+}
+
+plm_buffer_t *plm_buffer_create_with_chunks(void) {
+	plm_buffer_t *self = (plm_buffer_t *)malloc(sizeof(plm_buffer_t));
+	memset(self, 0, sizeof(plm_buffer_t));
+	self->bytes = self->bridge;
+	self->padding = PLM_BUFFER_PADDING;
+	self->mode = PLM_BUFFER_MODE_CHUNKS;
+	self->discard_read_bytes = TRUE;
+	self->scan_code = -1;
+	plm_buffer_init_kernels(self);
 	return self;
 }
 
@@ -1417,6 +2382,10 @@ void plm_buffer_destroy(plm_buffer_t *self) {
 	if (self->fh && self->close_when_done) {
 		fclose(self->fh);
 	}
+	if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+		plm_buffer_release_chunks(self, self->chunks_len);
+		free(self->chunks);
+	}
 	if (self->free_when_done) {
 		free(self->bytes);
 	}
@@ -1424,12 +2393,18 @@ void plm_buffer_destroy(plm_buffer_t *self) {
 }
 
 size_t plm_buffer_get_size(plm_buffer_t *self) {
+	if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+		return self->chunks_size;
+	}
 	return (self->mode == PLM_BUFFER_MODE_FILE)
 		? self->total_size
 		: self->length;
 }
 
 size_t plm_buffer_get_remaining(plm_buffer_t *self) {
+	if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+		return self->chunks_size - (plm_buffer_get_bit_position(self) >> 3);
+	}
 	return self->length - (self->bit_index >> 3);
 }
 
@@ -1438,17 +2413,31 @@ size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
 		return 0;
 	}
 
-	if (self->discard_read_bytes) {
-		// This should be a ring buffer, but instead it just shifts all unread 
-		// data to the beginning of the buffer and appends new data at the end. 
-		// Seems to be good enough.
+	if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+		uint8_t *copy = (uint8_t *)malloc(length);
+		memcpy(copy, bytes, length);
+		return plm_buffer_write_chunk(self, copy, length, plm_buffer_free_chunk, copy);
+	}
 
+	if (self->discard_read_bytes) {
 		plm_buffer_discard_read_bytes(self);
 		if (self->mode == PLM_BUFFER_MODE_RING) {
 			self->total_size = 0;
 		}
 	}
 
+	if (plm_buffer_is_ring(self)) {
+		if (self->capacity - (self->length - self->start) < length) {
+			plm_buffer_grow_ring(self, length);
+		}
+		memcpy(self->bytes + self->length, bytes, length);
+		plm_buffer_mirror(self, self->length, self->length + length);
+		self->length += length;
+		memset(self->bytes + self->length, 0, PLM_BUFFER_PADDING);
+		self->has_ended = FALSE;
+		return length;
+	}
+
 	// Do we have to resize to fit the new data?
 	size_t bytes_available = self->capacity - self->length;
 	if (bytes_available < length) {
@@ -1456,18 +2445,62 @@ size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
 		do {
 			new_size *= 2;
 		} while (new_size - self->length < length);
-		self->bytes = (uint8_t *)realloc(self->bytes, new_size);
+		self->bytes = (uint8_t *)realloc(self->bytes, new_size + PLM_BUFFER_PADDING);
 		self->capacity = new_size;
 	}
 
 	memcpy(self->bytes + self->length, bytes, length);
 	self->length += length;
+	memset(self->bytes + self->length, 0, PLM_BUFFER_PADDING);
+	self->has_ended = FALSE;
+	return length;
+}
+
+size_t plm_buffer_write_chunk(
+	plm_buffer_t *self, const uint8_t *bytes, size_t length,
+	plm_buffer_release_callback fp, void *user
+) {
+	if (self->mode != PLM_BUFFER_MODE_CHUNKS) {
+		return 0;
+	}
+
+	if (self->discard_read_bytes) {
+		plm_buffer_discard_read_bytes(self);
+		self->total_size = 0;
+	}
+
+	if (length == 0) {
+		if (fp) {
+			fp(self, user);
+		}
+		return 0;
+	}
+
+	if (self->chunks_len == self->chunks_capacity) {
+		self->chunks_capacity = self->chunks_capacity ? self->chunks_capacity * 2 : 16;
+		self->chunks = (plm_buffer_chunk_t *)realloc(
+			self->chunks, sizeof(plm_buffer_chunk_t) * self->chunks_capacity
+		);
+	}
+	plm_buffer_chunk_t *chunk = &self->chunks[self->chunks_len++];
+	chunk->bytes = bytes;
+	chunk->length = length;
+	chunk->release = fp;
+	chunk->user = user;
+	self->chunks_size += length;
 	self->has_ended = FALSE;
 	return length;
 }
 
+void plm_buffer_free_chunk(plm_buffer_t *self, void *user) {
+	PLM_UNUSED(self);
+	free(user);
+}
+
 void plm_buffer_signal_end(plm_buffer_t *self) {
-	self->total_size = self->length;
+	self->total_size = self->mode == PLM_BUFFER_MODE_CHUNKS
+		? self->chunks_size
+		: self->length;
 }
 
 void plm_buffer_set_load_callback(plm_buffer_t *self, plm_buffer_load_callback fp, void *user) {
@@ -1481,11 +2514,13 @@ void plm_buffer_rewind(plm_buffer_t *self) {
 
 void plm_buffer_seek(plm_buffer_t *self, size_t pos) {
 	self->has_ended = FALSE;
+	self->scan_code = -1;
 
 	if (self->mode == PLM_BUFFER_MODE_FILE) {
 		fseek(self->fh, pos, SEEK_SET);
 		self->bit_index = 0;
 		self->length = 0;
+		self->start = 0;
 	}
 	else if (self->mode == PLM_BUFFER_MODE_RING) {
 		if (pos != 0) {
@@ -1494,6 +2529,14 @@ void plm_buffer_seek(plm_buffer_t *self, size_t pos) {
 		}
 		self->bit_index = 0;
 		self->length = 0;
+		self->start = 0;
+		self->total_size = 0;
+	}
+	else if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+		if (pos != 0) {
+			return;
+		}
+		plm_buffer_release_chunks(self, self->chunks_len);
 		self->total_size = 0;
 	}
 	else if (pos < self->length) {
@@ -1504,20 +2547,95 @@ void plm_buffer_seek(plm_buffer_t *self, size_t pos) {
 size_t plm_buffer_tell(plm_buffer_t *self) {
 	return self->mode == PLM_BUFFER_MODE_FILE
 		? ftell(self->fh) + (self->bit_index >> 3) - self->length
-		: self->bit_index >> 3;
+		: plm_buffer_get_bit_position(self) >> 3;
 }
 
 void plm_buffer_discard_read_bytes(plm_buffer_t *self) {
+	if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+		size_t byte_pos = plm_buffer_get_bit_position(self) >> 3;
+		size_t end = 0;
+		int count = 0;
+		while (count < self->chunks_len && end + self->chunks[count].length <= byte_pos) {
+			end += self->chunks[count].length;
+			count++;
+		}
+		if (count > 0) {
+			plm_buffer_release_chunks(self, count);
+		}
+		return;
+	}
+
 	size_t byte_pos = self->bit_index >> 3;
+	self->start = byte_pos;
 	if (byte_pos == self->length) {
-		self->bit_index = 0;
-		self->length = 0;
+		plm_buffer_rebase(self, byte_pos);
+	}
+	else if (plm_buffer_is_ring(self)) {
+		// The read data is just left behind; see the comment at plm_buffer_t
+		if (byte_pos >= self->capacity) {
+			plm_buffer_rebase(self, self->capacity);
+		}
 	}
 	else if (byte_pos > 0) {
 		memmove(self->bytes, self->bytes + byte_pos, self->length - byte_pos);
-		self->bit_index -= byte_pos << 3;
-		self->length -= byte_pos;
+		plm_buffer_rebase(self, byte_pos);
+	}
+}
+
+// Move all positions back by count bytes, after the data at them has been
+// moved there (or already was, for ring buffers).
+
+void plm_buffer_rebase(plm_buffer_t *self, size_t count) {
+	self->bit_index -= count << 3;
+	self->length -= count;
+	self->start -= count;
+	if (self->mode == PLM_BUFFER_MODE_RING && self->total_size != 0) {
+		self->total_size -= count;
+	}
+
+	// Keep the last start code scan pointing at the same data
+	if (self->scan_from_bit_index >= count << 3) {
+		self->scan_from_bit_index -= count << 3;
+		self->scan_to_bit_index -= count << 3;
+	}
+	else {
+		self->scan_code = -1;
+	}
+}
+
+int plm_buffer_is_ring(plm_buffer_t *self) {
+	return self->mode == PLM_BUFFER_MODE_RING || self->mode == PLM_BUFFER_MODE_FILE;
+}
+
+// Make room for count more bytes in a ring buffer, when more than the capacity
+// would be unread. The data stays at the same positions, in case they are
+// kept somewhere; e.g. by plm_buffer_has_start_code().
+
+void plm_buffer_grow_ring(plm_buffer_t *self, size_t count) {
+	size_t new_capacity = self->capacity;
+	do {
+		new_capacity *= 2;
+	} while (new_capacity < self->length + count);
+
+	// All positions are below the new capacity, so there's nothing to mirror
+	uint8_t *bytes = (uint8_t *)malloc(new_capacity * 2 + PLM_BUFFER_PADDING);
+	memcpy(bytes + self->start, self->bytes + self->start, self->length - self->start);
+	free(self->bytes);
+	self->bytes = bytes;
+	self->capacity = new_capacity;
+}
+
+// Copy the bytes that were written to positions from..to-1 of a ring buffer
+// and lie past the capacity to one capacity earlier.
+
+void plm_buffer_mirror(plm_buffer_t *self, size_t from, size_t to) {
+	if (to <= self->capacity) {
+		return;
 	}
+	if (from < self->capacity) {
+		from = self->capacity;
+	}
+	memcpy(self->bytes + from - self->capacity, self->bytes + from, to - from);
 }
 
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user) {
@@ -1527,46 +2645,196 @@ void plm_buffer_load_file_callback(plm_buffer_t *self, void *user) {
 		plm_buffer_discard_read_bytes(self);
 	}
 
-	size_t bytes_available = self->capacity - self->length;
+	size_t bytes_available = self->capacity - (self->length - self->start);
 	size_t bytes_read = fread(self->bytes + self->length, 1, bytes_available, self->fh);
+	plm_buffer_mirror(self, self->length, self->length + bytes_read);
 	self->length += bytes_read;
+	memset(self->bytes + self->length, 0, PLM_BUFFER_PADDING);
 
 	if (bytes_read == 0) {
 		self->has_ended = TRUE;
 	}
 }
 
-int plm_buffer_has_ended(plm_buffer_t *self) {
-	return self->has_ended;
+// The read position in bits. Unlike bit_index, this stays valid when a
+// _with_chunks buffer moves on to another view.
+
+size_t plm_buffer_get_bit_position(plm_buffer_t *self) {
+	return (self->view_start << 3) + self->bit_index;
 }
 
-int plm_buffer_has(plm_buffer_t *self, size_t count) {
-	if (((self->length << 3) - self->bit_index) >= count) {
-		return TRUE;
+void plm_buffer_set_bit_position(plm_buffer_t *self, size_t pos) {
+	if (self->mode != PLM_BUFFER_MODE_CHUNKS) {
+		self->bit_index = pos;
 	}
-
-	if (self->load_callback) {
-		self->load_callback(self, self->load_callback_user_data);
-		
-		if (((self->length << 3) - self->bit_index) >= count) {
-			return TRUE;
-		}
-	}	
-	
-	if (self->total_size != 0 && self->length == self->total_size) {
-		self->has_ended = TRUE;
+	else if (pos >= self->view_start << 3 && pos <= (self->view_start + self->length) << 3) {
+		self->bit_index = pos - (self->view_start << 3);
+	}
+	else {
+		plm_buffer_select_view(self, pos, 0);
 	}
-	return FALSE;
 }
 
-int plm_buffer_read(plm_buffer_t *self, int count) {
-	if (!plm_buffer_has(self, count)) {
-		return 0;
+// Point the view of a _with_chunks buffer at the chunk that holds bit position
+// pos. If fewer than count bits are left in that chunk, copy as much of the
+// data from pos on as fits into the bridge, and view that instead.
+
+void plm_buffer_select_view(plm_buffer_t *self, size_t pos, size_t count) {
+	size_t byte_pos = pos >> 3;
+	size_t chunk_start = 0;
+	int i = 0;
+	if (byte_pos >= self->view_chunk_start) {
+		// Usually reading just moves on to the next chunk or two
+		chunk_start = self->view_chunk_start;
+		i = self->view_chunk;
+	}
+	while (i < self->chunks_len && chunk_start + self->chunks[i].length <= byte_pos) {
+		chunk_start += self->chunks[i].length;
+		i++;
+	}
+	self->view_chunk = i;
+	self->view_chunk_start = chunk_start;
+
+	if (i < self->chunks_len && ((chunk_start + self->chunks[i].length) << 3) - pos >= count) {
+		self->bytes = (uint8_t *)self->chunks[i].bytes;
+		self->length = self->chunks[i].length;
+		self->padding = 0;
+		self->view_start = chunk_start;
+		self->bit_index = pos - (chunk_start << 3);
+		return;
 	}
 
-	int value = 0;
-	while (count) {
-		int current_byte = self->bytes[self->bit_index >> 3];
+	size_t length = 0;
+	for (; i < self->chunks_len && length < PLM_BUFFER_BRIDGE_SIZE; i++) {
+		size_t offset = byte_pos + length - chunk_start;
+		size_t n = self->chunks[i].length - offset;
+		if (n > PLM_BUFFER_BRIDGE_SIZE - length) {
+			n = PLM_BUFFER_BRIDGE_SIZE - length;
+		}
+		memcpy(self->bridge + length, self->chunks[i].bytes + offset, n);
+		length += n;
+		chunk_start += self->chunks[i].length;
+	}
+	self->bytes = self->bridge;
+	self->length = length;
+	self->padding = PLM_BUFFER_PADDING;
+	self->view_start = byte_pos;
+	self->bit_index = pos & 7;
+}
+
+// Call the release callbacks of the first count chunks of a _with_chunks
+// buffer, and move all positions back by their size.
+
+void plm_buffer_release_chunks(plm_buffer_t *self, int count) {
+	size_t pos = plm_buffer_get_bit_position(self);
+	size_t size = 0;
+	for (int i = 0; i < count; i++) {
+		plm_buffer_chunk_t *chunk = &self->chunks[i];
+		if (chunk->release) {
+			chunk->release(self, chunk->user);
+		}
+		size += chunk->length;
+	}
+	memmove(self->chunks, self->chunks + count, sizeof(plm_buffer_chunk_t) * (self->chunks_len - count));
+	self->chunks_len -= count;
+	self->chunks_size -= size;
+	if (self->total_size != 0) {
+		self->total_size -= size;
+	}
+
+	if (self->scan_from_bit_index >= size << 3) {
+		self->scan_from_bit_index -= size << 3;
+		self->scan_to_bit_index -= size << 3;
+	}
+	else {
+		self->scan_code = -1;
+	}
+
+	self->view_chunk = 0;
+	self->view_chunk_start = 0;
+	plm_buffer_select_view(self, pos > size << 3 ? pos - (size << 3) : 0, 0);
+}
+
+int plm_buffer_has_ended(plm_buffer_t *self) {
+	return self->has_ended;
+}
+
+int plm_buffer_has(plm_buffer_t *self, size_t count) {
+	if (((self->length << 3) - self->bit_index) >= count) {
+		return TRUE;
+	}
+
+	if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+		plm_buffer_select_view(self, plm_buffer_get_bit_position(self), count);
+		if (((self->length << 3) - self->bit_index) >= count) {
+			return TRUE;
+		}
+	}
+
+	if (self->load_callback) {
+		self->load_callback(self, self->load_callback_user_data);
+		if (self->mode == PLM_BUFFER_MODE_CHUNKS) {
+			plm_buffer_select_view(self, plm_buffer_get_bit_position(self), count);
+		}
+		
+		if (((self->length << 3) - self->bit_index) >= count) {
+			return TRUE;
+		}
+	}	
+	
+	size_t size = self->mode == PLM_BUFFER_MODE_CHUNKS
+		? self->chunks_size
+		: self->length;
+	if (self->total_size != 0 && size == self->total_size) {
+		self->has_ended = TRUE;
+	}
+	return FALSE;
+}
+
+// Whether count bits are available and a 64-bit window can be loaded at the
+// current position without running past the end of the memory. This is the
+// only check on the fast path of the bit reader; only reads near the end of
+// the data go through plm_buffer_has() and the load callback.
+
+static inline int plm_buffer_can_load(plm_buffer_t *self, int count) {
+	return self->bit_index + count + 64 <= (self->length + self->padding) << 3;
+}
+
+// Load the next 64 bits starting at the current byte, big-endian, shifted so
+// the bit at bit_index is the MSB. At least 57 bits are valid.
+
+static inline uint64_t plm_buffer_load(plm_buffer_t *self) {
+	const uint8_t *p = self->bytes + (self->bit_index >> 3);
+	uint64_t window;
+	#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		memcpy(&window, p, 8);
+		window = __builtin_bswap64(window);
+	#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		memcpy(&window, p, 8);
+	#else
+		window = 0;
+		for (int i = 0; i < 8; i++) {
+			window = (window << 8) | p[i];
+		}
+	#endif
+	return window << (self->bit_index & 7);
+}
+
+int plm_buffer_read(plm_buffer_t *self, int count) {
+	// Fast path: the bits are in the buffer and a full window can be loaded
+	if (plm_buffer_can_load(self, count)) {
+		uint64_t window = plm_buffer_load(self);
+		self->bit_index += count;
+		return (int)((window >> 32) >> (32 - count));
+	}
+
+	if (!plm_buffer_has(self, count)) {
+		return 0;
+	}
+
+	int value = 0;
+	while (count) {
+		int current_byte = self->bytes[self->bit_index >> 3];
 
 		int remaining = 8 - (self->bit_index & 7); // Remaining bits in byte
 		int read = remaining < count ? remaining : count; // Bits in self run
@@ -1602,21 +2870,97 @@ int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v) {
 	return skipped;
 }
 
+// Return the first position in begin..end-1 where the bytes 00 00 01 of a
+// start code prefix begin, or end if there is none. bytes[end + 1] must still
+// be readable.
+
+size_t plm_buffer_scan_start_code(const uint8_t *bytes, size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		if (bytes[i] == 0x00 && bytes[i + 1] == 0x00 && bytes[i + 2] == 0x01) {
+			return i;
+		}
+	}
+	return end;
+}
+
+#ifdef PLM_SIMD_X86
+
+// Compare 16 (or 32) consecutive positions at once, by loading the data at
+// offsets 0, 1 and 2 and checking each for its byte of the prefix.
+
+PLM_TARGET_SSE2 size_t plm_buffer_scan_start_code_sse2(const uint8_t *bytes, size_t begin, size_t end) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi8(1);
+	size_t i = begin;
+	for (; i + 16 <= end; i += 16) {
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(bytes + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(bytes + i + 1));
+		__m128i b2 = _mm_loadu_si128((const __m128i *)(bytes + i + 2));
+		__m128i match = _mm_and_si128(
+			_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+			_mm_cmpeq_epi8(b2, one)
+		);
+		int mask = _mm_movemask_epi8(match);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return plm_buffer_scan_start_code(bytes, i, end);
+}
+
+PLM_TARGET_AVX2 size_t plm_buffer_scan_start_code_avx2(const uint8_t *bytes, size_t begin, size_t end) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi8(1);
+	size_t i = begin;
+	for (; i + 32 <= end; i += 32) {
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)(bytes + i));
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)(bytes + i + 1));
+		__m256i b2 = _mm256_loadu_si256((const __m256i *)(bytes + i + 2));
+		__m256i match = _mm256_and_si256(
+			_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+			_mm256_cmpeq_epi8(b2, one)
+		);
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(match);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return plm_buffer_scan_start_code(bytes, i, end);
+}
+
+#endif // PLM_SIMD_X86
+
+void plm_buffer_init_kernels(plm_buffer_t *self) {
+	self->scan_start_code = plm_buffer_scan_start_code;
+
+	#ifdef PLM_SIMD_X86
+		if (plm_cpu_has_avx2()) {
+			self->scan_start_code = plm_buffer_scan_start_code_avx2;
+		}
+		else if (plm_cpu_has_sse2()) {
+			self->scan_start_code = plm_buffer_scan_start_code_sse2;
+		}
+	#endif
+}
+
 int plm_buffer_next_start_code(plm_buffer_t *self) {
+	PLM_PROFILE_BEGIN(profile_start);
 	plm_buffer_align(self);
 
+	// A start code can begin anywhere that has at least 5 bytes left. Scan
+	// all of them in one go, then try to load more data.
 	while (plm_buffer_has(self, (5 << 3))) {
 		size_t byte_index = (self->bit_index) >> 3;
-		if (
-			self->bytes[byte_index] == 0x00 &&
-			self->bytes[byte_index + 1] == 0x00 &&
-			self->bytes[byte_index + 2] == 0x01
-		) {
-			self->bit_index = (byte_index + 4) << 3;
-			return self->bytes[byte_index + 3];
+		size_t end = self->length - 4;
+		size_t found = self->scan_start_code(self->bytes, byte_index, end);
+		if (found != end) {
+			self->bit_index = (found + 4) << 3;
+			PLM_PROFILE_END(&self->profile, PLM_PROFILE_START_CODE, profile_start);
+			return self->bytes[found + 3];
 		}
-		self->bit_index += 8;
+		self->bit_index = end << 3;
 	}
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_START_CODE, profile_start);
 	return -1;
 }
 
@@ -1624,21 +2968,35 @@ int plm_buffer_find_start_code(plm_buffer_t *self, int code) {
 	int current = 0;
 	while (TRUE) {
 		current = plm_buffer_next_start_code(self);
-		if (current == code || current == -1) {
+		if (current == code || current == -1 || code == PLM_BUFFER_ANY_START_CODE) {
 			return current;
 		}
 	}
 	return -1;
 }
 
+// Callers typically ask again from the same position after each write, until
+// the start code arrives. Data that has been scanned before is skipped, so
+// each byte is only looked at once.
+
 int plm_buffer_has_start_code(plm_buffer_t *self, int code) {
-	size_t previous_bit_index = self->bit_index;
+	size_t previous_bit_index = plm_buffer_get_bit_position(self);
 	int previous_discard_read_bytes = self->discard_read_bytes;
+
+	if (self->scan_code == code && self->scan_from_bit_index == previous_bit_index) {
+		plm_buffer_set_bit_position(self, self->scan_to_bit_index);
+	}
 	
 	self->discard_read_bytes = FALSE;
 	int current = plm_buffer_find_start_code(self, code);
 
-	self->bit_index = previous_bit_index;
+	if (current == -1) {
+		self->scan_code = code;
+		self->scan_from_bit_index = previous_bit_index;
+		self->scan_to_bit_index = plm_buffer_get_bit_position(self);
+	}
+
+	plm_buffer_set_bit_position(self, previous_bit_index);
 	self->discard_read_bytes = previous_discard_read_bytes;
 	return current;
 }
@@ -1653,16 +3011,48 @@ int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
 	return val != 0;
 }
 
-int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table) {
-	plm_vlc_t state = {0, 0};
+// Return the next count (at most 17) bits without consuming them. Bits past
+// the end of the data read as 0, same as with plm_buffer_read().
+
+int plm_buffer_peek(plm_buffer_t *self, int count) {
+	if (plm_buffer_can_load(self, count)) {
+		return (int)((plm_buffer_load(self) >> 32) >> (32 - count));
+	}
+
+	plm_buffer_has(self, count);
+
+	size_t byte_index = self->bit_index >> 3;
+	uint32_t window = 0;
+	for (int i = 0; i < 3; i++) {
+		window <<= 8;
+		if (byte_index + i < self->length) {
+			window |= self->bytes[byte_index + i];
+		}
+	}
+	int shift = 24 - (int)(self->bit_index & 7) - count;
+	return (window >> shift) & ((1 << count) - 1);
+}
+
+int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_table_t *table) {
+	plm_vlc_lut_t entry = table->lut[plm_buffer_peek(self, table->bits)];
+
+	// Consume the code, but not past the end of the data
+	size_t length = entry.length ? entry.length : table->bits;
+	size_t available = (self->length << 3) - self->bit_index;
+	self->bit_index += length < available ? length : available;
+	if (entry.length) {
+		return entry.value;
+	}
+
+	plm_vlc_t state = {entry.value, 0};
 	do {
-		state = table[state.index + plm_buffer_read(self, 1)];
+		state = table->tree[state.index + plm_buffer_read(self, 1)];
 	} while (state.index > 0);
 	return state.value;
 }
 
-uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table) {
-	return (uint16_t)plm_buffer_read_vlc(self, (const plm_vlc_t *)table);
+uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_table_t *table) {
+	return (uint16_t)plm_buffer_read_vlc(self, table);
 }
 
 
@@ -1693,11 +3083,16 @@ struct plm_demux_t {
 	int num_video_streams;
 	plm_packet_t current_packet;
 	plm_packet_t next_packet;
+
+	#ifdef PLM_PROFILE
+		plm_profile_t profile;
+	#endif
 };
 
 
 void plm_demux_buffer_seek(plm_demux_t *self, size_t pos);
 double plm_demux_decode_time(plm_demux_t *self);
+plm_packet_t *plm_demux_decode_next(plm_demux_t *self);
 plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type);
 plm_packet_t *plm_demux_get_packet(plm_demux_t *self);
 
@@ -1976,14 +3371,11 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
 			// later, when we know it's the last intra frame before desired
 			// seek time.
 			if (force_intra) {
-				for (size_t i = 0; i < packet->length - 6; i++) {
+				size_t end = packet->length - 6;
+				for (size_t i = 0; i < end; i++) {
 					// Find the START_PICTURE code
-					if (
-						packet->data[i] == 0x00 &&
-						packet->data[i + 1] == 0x00 &&
-						packet->data[i + 2] == 0x01 &&
-						packet->data[i + 3] == 0x00
-					) {
+					i = self->buffer->scan_start_code(packet->data, i, end);
+					if (i < end && packet->data[i + 3] == 0x00) {
 						// Bits 11--13 in the picture header contain the frame 
 						// type, where 1=Intra
 						if ((packet->data[i + 5] & 0x38) == 8) {
@@ -2027,6 +3419,23 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
 }
 
 plm_packet_t *plm_demux_decode(plm_demux_t *self) {
+	PLM_PROFILE_BEGIN(profile_start);
+	plm_packet_t *packet = plm_demux_decode_next(self);
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_DEMUX, profile_start);
+	return packet;
+}
+
+#ifdef PLM_PROFILE
+plm_profile_t plm_demux_get_profile(plm_demux_t *self) {
+	plm_profile_t profile = self->profile;
+	plm_profile_add(&profile, &self->buffer->profile);
+	memset(&self->profile, 0, sizeof(plm_profile_t));
+	memset(&self->buffer->profile, 0, sizeof(plm_profile_t));
+	return profile;
+}
+#endif
+
+plm_packet_t *plm_demux_decode_next(plm_demux_t *self) {
 	if (!plm_demux_has_headers(self)) {
 		return NULL;
 	}
@@ -2191,7 +3600,7 @@ static const uint8_t PLM_VIDEO_NON_INTRA_QUANT_MATRIX[] = {
 	16, 16, 16, 16, 16, 16, 16, 16
 };
 
-static const uint8_t PLM_VIDEO_PREMULTIPLIER_MATRIX[] = {
+static const int16_t PLM_VIDEO_PREMULTIPLIER_MATRIX[] = {
 	32, 44, 42, 38, 32, 25, 17,  9,
 	44, 62, 58, 52, 44, 35, 24, 12,
 	42, 58, 55, 49, 42, 33, 23, 12,
@@ -2202,7 +3611,11 @@ static const uint8_t PLM_VIDEO_PREMULTIPLIER_MATRIX[] = {
 	 9, 12, 12, 10,  9,  7,  5,  2
 };
 
-static const plm_vlc_t PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT[] = {
+// VLC tables. Each *_TREE is the binary tree of the code, walked one bit at a
+// time. The *_LUT after it is derived from the tree and resolves the first
+// bits of the code in a single lookup, see plm_vlc_lut_t.
+
+static const plm_vlc_t PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_TREE[] = {
 	{  1 << 1,    0}, {       0,    1},  //   0: x
 	{  2 << 1,    0}, {  3 << 1,    0},  //   1: 0x
 	{  4 << 1,    0}, {  5 << 1,    0},  //   2: 00x
@@ -2245,12 +3658,59 @@ static const plm_vlc_t PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT[] = {
 	{       0,   23}, {       0,   22},  //  39: 0000 0100 01x
 };
 
-static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_INTRA[] = {
+static const plm_vlc_lut_t PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT[] = {
+	{       0,  8}, { 20 << 1,  0}, {       0,  8}, { 21 << 1,  0}, { 22 << 1,  0}, { 23 << 1,  0}, {      15,  8}, {      14,  8},  // 0000 0xxx
+	{      13,  8}, {      12,  8}, {      11,  8}, {      10,  8}, {       9,  7}, {       9,  7}, {       8,  7}, {       8,  7},  // 0000 1xxx
+	{       7,  5}, {       7,  5}, {       7,  5}, {       7,  5}, {       7,  5}, {       7,  5}, {       7,  5}, {       7,  5},  // 0001 0xxx
+	{       6,  5}, {       6,  5}, {       6,  5}, {       6,  5}, {       6,  5}, {       6,  5}, {       6,  5}, {       6,  5},  // 0001 1xxx
+	{       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4},  // 0010 0xxx
+	{       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4},  // 0010 1xxx
+	{       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4},  // 0011 0xxx
+	{       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4},  // 0011 1xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 0100 0xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 0100 1xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 0101 0xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 0101 1xxx
+	{       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3},  // 0110 0xxx
+	{       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3},  // 0110 1xxx
+	{       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3},  // 0111 0xxx
+	{       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3}, {       2,  3},  // 0111 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1000 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1000 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1001 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1001 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1010 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1010 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1011 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1011 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1100 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1100 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1101 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1101 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1110 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1110 1xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1111 0xxx
+	{       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1}, {       1,  1},  // 1111 1xxx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT = {
+	8, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_LUT, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT_TREE
+};
+
+static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_INTRA_TREE[] = {
 	{  1 << 1,    0}, {       0,  0x01},  //   0: x
 	{      -1,    0}, {       0,  0x11},  //   1: 0x
 };
 
-static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE[] = {
+static const plm_vlc_lut_t PLM_VIDEO_MACROBLOCK_TYPE_INTRA_LUT[] = {
+	{    0x00,  2}, {    0x11,  2}, {    0x01,  1}, {    0x01,  1},  // xx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_MACROBLOCK_TYPE_INTRA = {
+	2, PLM_VIDEO_MACROBLOCK_TYPE_INTRA_LUT, PLM_VIDEO_MACROBLOCK_TYPE_INTRA_TREE
+};
+
+static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE_TREE[] = {
 	{  1 << 1,    0}, {       0, 0x0a},  //   0: x
 	{  2 << 1,    0}, {       0, 0x02},  //   1: 0x
 	{  3 << 1,    0}, {       0, 0x08},  //   2: 00x
@@ -2260,7 +3720,22 @@ static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE[] = {
 	{      -1,    0}, {       0, 0x11},  //   6: 0000 0x
 };
 
-static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_B[] = {
+static const plm_vlc_lut_t PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE_LUT[] = {
+	{    0x00,  6}, {    0x11,  6}, {    0x12,  5}, {    0x12,  5}, {    0x1a,  5}, {    0x1a,  5}, {    0x01,  5}, {    0x01,  5},  // 000x xx
+	{    0x08,  3}, {    0x08,  3}, {    0x08,  3}, {    0x08,  3}, {    0x08,  3}, {    0x08,  3}, {    0x08,  3}, {    0x08,  3},  // 001x xx
+	{    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2},  // 010x xx
+	{    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2}, {    0x02,  2},  // 011x xx
+	{    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1},  // 100x xx
+	{    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1},  // 101x xx
+	{    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1},  // 110x xx
+	{    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1}, {    0x0a,  1},  // 111x xx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE = {
+	6, PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE_LUT, PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE_TREE
+};
+
+static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_B_TREE[] = {
 	{  1 << 1,    0}, {  2 << 1,    0},  //   0: x
 	{  3 << 1,    0}, {  4 << 1,    0},  //   1: 0x
 	{       0, 0x0c}, {       0, 0x0e},  //   2: 1x
@@ -2274,14 +3749,29 @@ static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_B[] = {
 	{       0, 0x16}, {       0, 0x1a},  //  10: 0000 1x
 };
 
-static const plm_vlc_t *PLM_VIDEO_MACROBLOCK_TYPE[] = {
+static const plm_vlc_lut_t PLM_VIDEO_MACROBLOCK_TYPE_B_LUT[] = {
+	{    0x00,  6}, {    0x11,  6}, {    0x16,  6}, {    0x1a,  6}, {    0x1e,  5}, {    0x1e,  5}, {    0x01,  5}, {    0x01,  5},  // 000x xx
+	{    0x08,  4}, {    0x08,  4}, {    0x08,  4}, {    0x08,  4}, {    0x0a,  4}, {    0x0a,  4}, {    0x0a,  4}, {    0x0a,  4},  // 001x xx
+	{    0x04,  3}, {    0x04,  3}, {    0x04,  3}, {    0x04,  3}, {    0x04,  3}, {    0x04,  3}, {    0x04,  3}, {    0x04,  3},  // 010x xx
+	{    0x06,  3}, {    0x06,  3}, {    0x06,  3}, {    0x06,  3}, {    0x06,  3}, {    0x06,  3}, {    0x06,  3}, {    0x06,  3},  // 011x xx
+	{    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2},  // 100x xx
+	{    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2}, {    0x0c,  2},  // 101x xx
+	{    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2},  // 110x xx
+	{    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2}, {    0x0e,  2},  // 111x xx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_MACROBLOCK_TYPE_B = {
+	6, PLM_VIDEO_MACROBLOCK_TYPE_B_LUT, PLM_VIDEO_MACROBLOCK_TYPE_B_TREE
+};
+
+static const plm_vlc_table_t *PLM_VIDEO_MACROBLOCK_TYPE[] = {
 	NULL,
-	PLM_VIDEO_MACROBLOCK_TYPE_INTRA,
-	PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE,
-	PLM_VIDEO_MACROBLOCK_TYPE_B
+	&PLM_VIDEO_MACROBLOCK_TYPE_INTRA,
+	&PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE,
+	&PLM_VIDEO_MACROBLOCK_TYPE_B
 };
 
-static const plm_vlc_t PLM_VIDEO_CODE_BLOCK_PATTERN[] = {
+static const plm_vlc_t PLM_VIDEO_CODE_BLOCK_PATTERN_TREE[] = {
 	{  1 << 1,    0}, {  2 << 1,    0},  //   0: x
 	{  3 << 1,    0}, {  4 << 1,    0},  //   1: 0x
 	{  5 << 1,    0}, {  6 << 1,    0},  //   2: 1x
@@ -2347,7 +3837,46 @@ static const plm_vlc_t PLM_VIDEO_CODE_BLOCK_PATTERN[] = {
 	{       0,   47}, {       0,   31},  //  62: 0000 0011x
 };
 
-static const plm_vlc_t PLM_VIDEO_MOTION[] = {
+static const plm_vlc_lut_t PLM_VIDEO_CODE_BLOCK_PATTERN_LUT[] = {
+	{       0,  8}, { 60 << 1,  0}, { 61 << 1,  0}, { 62 << 1,  0}, {      58,  8}, {      54,  8}, {      46,  8}, {      30,  8},  // 0000 0xxx
+	{      57,  8}, {      53,  8}, {      45,  8}, {      29,  8}, {      38,  8}, {      26,  8}, {      37,  8}, {      25,  8},  // 0000 1xxx
+	{      43,  8}, {      23,  8}, {      51,  8}, {      15,  8}, {      42,  8}, {      22,  8}, {      50,  8}, {      14,  8},  // 0001 0xxx
+	{      41,  8}, {      21,  8}, {      49,  8}, {      13,  8}, {      35,  8}, {      19,  8}, {      11,  8}, {       7,  8},  // 0001 1xxx
+	{      34,  7}, {      34,  7}, {      18,  7}, {      18,  7}, {      10,  7}, {      10,  7}, {       6,  7}, {       6,  7},  // 0010 0xxx
+	{      33,  7}, {      33,  7}, {      17,  7}, {      17,  7}, {       9,  7}, {       9,  7}, {       5,  7}, {       5,  7},  // 0010 1xxx
+	{      63,  6}, {      63,  6}, {      63,  6}, {      63,  6}, {       3,  6}, {       3,  6}, {       3,  6}, {       3,  6},  // 0011 0xxx
+	{      36,  6}, {      36,  6}, {      36,  6}, {      36,  6}, {      24,  6}, {      24,  6}, {      24,  6}, {      24,  6},  // 0011 1xxx
+	{      62,  5}, {      62,  5}, {      62,  5}, {      62,  5}, {      62,  5}, {      62,  5}, {      62,  5}, {      62,  5},  // 0100 0xxx
+	{       2,  5}, {       2,  5}, {       2,  5}, {       2,  5}, {       2,  5}, {       2,  5}, {       2,  5}, {       2,  5},  // 0100 1xxx
+	{      61,  5}, {      61,  5}, {      61,  5}, {      61,  5}, {      61,  5}, {      61,  5}, {      61,  5}, {      61,  5},  // 0101 0xxx
+	{       1,  5}, {       1,  5}, {       1,  5}, {       1,  5}, {       1,  5}, {       1,  5}, {       1,  5}, {       1,  5},  // 0101 1xxx
+	{      56,  5}, {      56,  5}, {      56,  5}, {      56,  5}, {      56,  5}, {      56,  5}, {      56,  5}, {      56,  5},  // 0110 0xxx
+	{      52,  5}, {      52,  5}, {      52,  5}, {      52,  5}, {      52,  5}, {      52,  5}, {      52,  5}, {      52,  5},  // 0110 1xxx
+	{      44,  5}, {      44,  5}, {      44,  5}, {      44,  5}, {      44,  5}, {      44,  5}, {      44,  5}, {      44,  5},  // 0111 0xxx
+	{      28,  5}, {      28,  5}, {      28,  5}, {      28,  5}, {      28,  5}, {      28,  5}, {      28,  5}, {      28,  5},  // 0111 1xxx
+	{      40,  5}, {      40,  5}, {      40,  5}, {      40,  5}, {      40,  5}, {      40,  5}, {      40,  5}, {      40,  5},  // 1000 0xxx
+	{      20,  5}, {      20,  5}, {      20,  5}, {      20,  5}, {      20,  5}, {      20,  5}, {      20,  5}, {      20,  5},  // 1000 1xxx
+	{      48,  5}, {      48,  5}, {      48,  5}, {      48,  5}, {      48,  5}, {      48,  5}, {      48,  5}, {      48,  5},  // 1001 0xxx
+	{      12,  5}, {      12,  5}, {      12,  5}, {      12,  5}, {      12,  5}, {      12,  5}, {      12,  5}, {      12,  5},  // 1001 1xxx
+	{      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4},  // 1010 0xxx
+	{      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4}, {      32,  4},  // 1010 1xxx
+	{      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4},  // 1011 0xxx
+	{      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4}, {      16,  4},  // 1011 1xxx
+	{       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4},  // 1100 0xxx
+	{       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4}, {       8,  4},  // 1100 1xxx
+	{       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4},  // 1101 0xxx
+	{       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4},  // 1101 1xxx
+	{      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3},  // 1110 0xxx
+	{      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3},  // 1110 1xxx
+	{      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3},  // 1111 0xxx
+	{      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3}, {      60,  3},  // 1111 1xxx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_CODE_BLOCK_PATTERN = {
+	8, PLM_VIDEO_CODE_BLOCK_PATTERN_LUT, PLM_VIDEO_CODE_BLOCK_PATTERN_TREE
+};
+
+static const plm_vlc_t PLM_VIDEO_MOTION_TREE[] = {
 	{  1 << 1,    0}, {       0,    0},  //   0: x
 	{  2 << 1,    0}, {  3 << 1,    0},  //   1: 0x
 	{  4 << 1,    0}, {  5 << 1,    0},  //   2: 00x
@@ -2384,7 +3913,46 @@ static const plm_vlc_t PLM_VIDEO_MOTION[] = {
 	{       0,   11}, {       0,  -11},  //  33: 0000 0100 01x
 };
 
-static const plm_vlc_t PLM_VIDEO_DCT_SIZE_LUMINANCE[] = {
+static const plm_vlc_lut_t PLM_VIDEO_MOTION_LUT[] = {
+	{       0,  7}, {       0,  7}, {       0,  8}, { 19 << 1,  0}, { 20 << 1,  0}, { 21 << 1,  0}, {       7,  8}, {      -7,  8},  // 0000 0xxx
+	{       6,  8}, {      -6,  8}, {       5,  8}, {      -5,  8}, {       4,  7}, {       4,  7}, {      -4,  7}, {      -4,  7},  // 0000 1xxx
+	{       3,  5}, {       3,  5}, {       3,  5}, {       3,  5}, {       3,  5}, {       3,  5}, {       3,  5}, {       3,  5},  // 0001 0xxx
+	{      -3,  5}, {      -3,  5}, {      -3,  5}, {      -3,  5}, {      -3,  5}, {      -3,  5}, {      -3,  5}, {      -3,  5},  // 0001 1xxx
+	{       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4},  // 0010 0xxx
+	{       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4}, {       2,  4},  // 0010 1xxx
+	{      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4},  // 0011 0xxx
+	{      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4}, {      -2,  4},  // 0011 1xxx
+	{       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3},  // 0100 0xxx
+	{       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3},  // 0100 1xxx
+	{       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3},  // 0101 0xxx
+	{       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3}, {       1,  3},  // 0101 1xxx
+	{      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3},  // 0110 0xxx
+	{      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3},  // 0110 1xxx
+	{      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3},  // 0111 0xxx
+	{      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3}, {      -1,  3},  // 0111 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1000 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1000 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1001 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1001 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1010 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1010 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1011 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1011 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1100 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1100 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1101 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1101 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1110 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1110 1xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1111 0xxx
+	{       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1}, {       0,  1},  // 1111 1xxx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_MOTION = {
+	8, PLM_VIDEO_MOTION_LUT, PLM_VIDEO_MOTION_TREE
+};
+
+static const plm_vlc_t PLM_VIDEO_DCT_SIZE_LUMINANCE_TREE[] = {
 	{  1 << 1,    0}, {  2 << 1,    0},  //   0: x
 	{       0,    1}, {       0,    2},  //   1: 0x
 	{  3 << 1,    0}, {  4 << 1,    0},  //   2: 1x
@@ -2396,7 +3964,30 @@ static const plm_vlc_t PLM_VIDEO_DCT_SIZE_LUMINANCE[] = {
 	{       0,    8}, {      -1,    0},  //   8: 1111 11x
 };
 
-static const plm_vlc_t PLM_VIDEO_DCT_SIZE_CHROMINANCE[] = {
+static const plm_vlc_lut_t PLM_VIDEO_DCT_SIZE_LUMINANCE_LUT[] = {
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0000 xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0001 xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0010 xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0011 xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 0100 xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 0101 xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 0110 xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 0111 xxx
+	{       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3},  // 1000 xxx
+	{       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3}, {       0,  3},  // 1001 xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 1010 xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 1011 xxx
+	{       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3},  // 1100 xxx
+	{       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3}, {       4,  3},  // 1101 xxx
+	{       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4}, {       5,  4},  // 1110 xxx
+	{       6,  5}, {       6,  5}, {       6,  5}, {       6,  5}, {       7,  6}, {       7,  6}, {       8,  7}, {       0,  7},  // 1111 xxx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_DCT_SIZE_LUMINANCE = {
+	7, PLM_VIDEO_DCT_SIZE_LUMINANCE_LUT, PLM_VIDEO_DCT_SIZE_LUMINANCE_TREE
+};
+
+static const plm_vlc_t PLM_VIDEO_DCT_SIZE_CHROMINANCE_TREE[] = {
 	{  1 << 1,    0}, {  2 << 1,    0},  //   0: x
 	{       0,    0}, {       0,    1},  //   1: 0x
 	{       0,    2}, {  3 << 1,    0},  //   2: 1x
@@ -2408,10 +3999,49 @@ static const plm_vlc_t PLM_VIDEO_DCT_SIZE_CHROMINANCE[] = {
 	{       0,    8}, {      -1,    0},  //   8: 1111 111x
 };
 
-static const plm_vlc_t *PLM_VIDEO_DCT_SIZE[] = {
-	PLM_VIDEO_DCT_SIZE_LUMINANCE,
-	PLM_VIDEO_DCT_SIZE_CHROMINANCE,
-	PLM_VIDEO_DCT_SIZE_CHROMINANCE
+static const plm_vlc_lut_t PLM_VIDEO_DCT_SIZE_CHROMINANCE_LUT[] = {
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0000 0xxx
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0000 1xxx
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0001 0xxx
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0001 1xxx
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0010 0xxx
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0010 1xxx
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0011 0xxx
+	{       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2}, {       0,  2},  // 0011 1xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0100 0xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0100 1xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0101 0xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0101 1xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0110 0xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0110 1xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0111 0xxx
+	{       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2}, {       1,  2},  // 0111 1xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1000 0xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1000 1xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1001 0xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1001 1xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1010 0xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1010 1xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1011 0xxx
+	{       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2}, {       2,  2},  // 1011 1xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 1100 0xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 1100 1xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 1101 0xxx
+	{       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3}, {       3,  3},  // 1101 1xxx
+	{       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4},  // 1110 0xxx
+	{       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4}, {       4,  4},  // 1110 1xxx
+	{       5,  5}, {       5,  5}, {       5,  5}, {       5,  5}, {       5,  5}, {       5,  5}, {       5,  5}, {       5,  5},  // 1111 0xxx
+	{       6,  6}, {       6,  6}, {       6,  6}, {       6,  6}, {       7,  7}, {       7,  7}, {       8,  8}, {       0,  8},  // 1111 1xxx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_DCT_SIZE_CHROMINANCE = {
+	8, PLM_VIDEO_DCT_SIZE_CHROMINANCE_LUT, PLM_VIDEO_DCT_SIZE_CHROMINANCE_TREE
+};
+
+static const plm_vlc_table_t *PLM_VIDEO_DCT_SIZE[] = {
+	&PLM_VIDEO_DCT_SIZE_LUMINANCE,
+	&PLM_VIDEO_DCT_SIZE_CHROMINANCE,
+	&PLM_VIDEO_DCT_SIZE_CHROMINANCE
 };
 
 
@@ -2421,7 +4051,7 @@ static const plm_vlc_t *PLM_VIDEO_DCT_SIZE[] = {
 
 //  Decoded values are unsigned. Sign bit follows in the stream.
 
-static const plm_vlc_uint_t PLM_VIDEO_DCT_COEFF[] = {
+static const plm_vlc_uint_t PLM_VIDEO_DCT_COEFF_TREE[] = {
 	{  1 << 1,        0}, {       0,   0x0001},  //   0: x
 	{  2 << 1,        0}, {  3 << 1,        0},  //   1: 0x
 	{  4 << 1,        0}, {  5 << 1,        0},  //   2: 00x
@@ -2536,6 +4166,141 @@ static const plm_vlc_uint_t PLM_VIDEO_DCT_COEFF[] = {
 	{       0,   0x1c01}, {       0,   0x1b01},  // 111: 0000 0000 0001 111x
 };
 
+static const plm_vlc_uint_lut_t PLM_VIDEO_DCT_COEFF_LUT[] = {
+	{ 39 << 1,  0}, { 40 << 1,  0}, { 41 << 1,  0}, { 42 << 1,  0}, { 43 << 1,  0}, { 44 << 1,  0}, { 45 << 1,  0}, { 46 << 1,  0},  // 0000 000x xx
+	{  0x1001, 10}, {  0x0502, 10}, {  0x0007, 10}, {  0x0203, 10}, {  0x0104, 10}, {  0x0f01, 10}, {  0x0e01, 10}, {  0x0402, 10},  // 0000 001x xx
+	{  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6},  // 0000 010x xx
+	{  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6}, {  0xffff,  6},  // 0000 011x xx
+	{  0x0202,  7}, {  0x0202,  7}, {  0x0202,  7}, {  0x0202,  7}, {  0x0202,  7}, {  0x0202,  7}, {  0x0202,  7}, {  0x0202,  7},  // 0000 100x xx
+	{  0x0901,  7}, {  0x0901,  7}, {  0x0901,  7}, {  0x0901,  7}, {  0x0901,  7}, {  0x0901,  7}, {  0x0901,  7}, {  0x0901,  7},  // 0000 101x xx
+	{  0x0004,  7}, {  0x0004,  7}, {  0x0004,  7}, {  0x0004,  7}, {  0x0004,  7}, {  0x0004,  7}, {  0x0004,  7}, {  0x0004,  7},  // 0000 110x xx
+	{  0x0801,  7}, {  0x0801,  7}, {  0x0801,  7}, {  0x0801,  7}, {  0x0801,  7}, {  0x0801,  7}, {  0x0801,  7}, {  0x0801,  7},  // 0000 111x xx
+	{  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6},  // 0001 000x xx
+	{  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6}, {  0x0701,  6},  // 0001 001x xx
+	{  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6},  // 0001 010x xx
+	{  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6}, {  0x0601,  6},  // 0001 011x xx
+	{  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6},  // 0001 100x xx
+	{  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6}, {  0x0102,  6},  // 0001 101x xx
+	{  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6},  // 0001 110x xx
+	{  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6}, {  0x0501,  6},  // 0001 111x xx
+	{  0x0d01,  8}, {  0x0d01,  8}, {  0x0d01,  8}, {  0x0d01,  8}, {  0x0006,  8}, {  0x0006,  8}, {  0x0006,  8}, {  0x0006,  8},  // 0010 000x xx
+	{  0x0c01,  8}, {  0x0c01,  8}, {  0x0c01,  8}, {  0x0c01,  8}, {  0x0b01,  8}, {  0x0b01,  8}, {  0x0b01,  8}, {  0x0b01,  8},  // 0010 001x xx
+	{  0x0302,  8}, {  0x0302,  8}, {  0x0302,  8}, {  0x0302,  8}, {  0x0103,  8}, {  0x0103,  8}, {  0x0103,  8}, {  0x0103,  8},  // 0010 010x xx
+	{  0x0005,  8}, {  0x0005,  8}, {  0x0005,  8}, {  0x0005,  8}, {  0x0a01,  8}, {  0x0a01,  8}, {  0x0a01,  8}, {  0x0a01,  8},  // 0010 011x xx
+	{  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5},  // 0010 100x xx
+	{  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5},  // 0010 101x xx
+	{  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5},  // 0010 110x xx
+	{  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5}, {  0x0003,  5},  // 0010 111x xx
+	{  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5},  // 0011 000x xx
+	{  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5},  // 0011 001x xx
+	{  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5},  // 0011 010x xx
+	{  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5}, {  0x0401,  5},  // 0011 011x xx
+	{  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5},  // 0011 100x xx
+	{  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5},  // 0011 101x xx
+	{  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5},  // 0011 110x xx
+	{  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5}, {  0x0301,  5},  // 0011 111x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 000x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 001x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 010x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 011x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 100x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 101x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 110x xx
+	{  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4}, {  0x0002,  4},  // 0100 111x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 000x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 001x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 010x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 011x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 100x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 101x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 110x xx
+	{  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4}, {  0x0201,  4},  // 0101 111x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 000x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 001x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 010x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 011x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 100x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 101x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 110x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0110 111x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 000x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 001x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 010x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 011x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 100x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 101x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 110x xx
+	{  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3}, {  0x0101,  3},  // 0111 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1000 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1001 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1010 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1011 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1100 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1101 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1110 111x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 000x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 001x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 010x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 011x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 100x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 101x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 110x xx
+	{  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1}, {  0x0001,  1},  // 1111 111x xx
+};
+
+static const plm_vlc_table_t PLM_VIDEO_DCT_COEFF = {
+	10, (const plm_vlc_lut_t *)PLM_VIDEO_DCT_COEFF_LUT, (const plm_vlc_t *)PLM_VIDEO_DCT_COEFF_TREE
+};
+
 typedef struct {
 	int full_px;
 	int is_set;
@@ -2544,6 +4309,78 @@ typedef struct {
 	int v;
 } plm_video_motion_t;
 
+// The frames the decoder allocates itself have a border of this many pixels
+// around the luma planes, and half of that around the chroma planes, with the
+// edge pixels of the picture replicated into it. Rows are 32-byte aligned.
+
+#define PLM_VIDEO_BORDER 32
+
+// Motion compensation kernel for one block of a plane; both s and d point to
+// the top left pixel of the block and have a stride of dw.
+
+typedef void(*plm_video_mc_t)(uint8_t *d, uint8_t *s, int dw);
+
+// A unit of work for the worker threads: either one slice of the current
+// picture, or a whole B-picture decoded into its own frame. bit_index points
+// just past the start code. A slice starts at macroblock address and ends
+// where the next one starts, at end_address and end_bit_index. For B-pictures,
+// the buffer position and start code the decoder stopped at are reported back
+// in end_*.
+
+typedef struct {
+	int slice;
+	size_t bit_index;
+	plm_frame_t *frame;
+	int address;
+	int end_address;
+	size_t end_bit_index;
+	int end_start_code;
+} plm_video_task_t;
+
+// Two-pass decoding parses up to PLM_VIDEO_BATCH_SIZE macroblocks into
+// records, then predicts and reconstructs them all. A record has what the
+// second pass needs, including the motion vectors at the time, and the
+// number of coefficients and their support for each coded block; n is 0 for
+// the others. The coefficients are in coeffs at the same index, and are all
+// zero again once reconstructed.
+
+#define PLM_VIDEO_BATCH_SIZE 32
+
+typedef struct {
+	int mb_row;
+	int mb_col;
+	int intra;
+	plm_video_motion_t motion_forward;
+	plm_video_motion_t motion_backward;
+	uint8_t n[6];
+	uint8_t support[6];
+} plm_video_record_t;
+
+typedef struct {
+	int len;
+	plm_video_record_t records[PLM_VIDEO_BATCH_SIZE];
+	int16_t coeffs[PLM_VIDEO_BATCH_SIZE][6][64];
+} plm_video_batch_t;
+
+typedef struct plm_video_worker_t plm_video_worker_t;
+
+// How far incremental decoding got into the current picture: not started,
+// looking for the first or next slice, about to read a slice header, or in
+// between the macroblocks of a slice.
+
+enum plm_video_progress {
+	PLM_VIDEO_PROGRESS_NONE,
+	PLM_VIDEO_PROGRESS_FIRST_SLICE,
+	PLM_VIDEO_PROGRESS_SLICES,
+	PLM_VIDEO_PROGRESS_SLICE_BEGIN,
+	PLM_VIDEO_PROGRESS_MACROBLOCKS
+};
+
+// The most a macroblock can take up, unless padded with stuffing: six blocks
+// of 63 escaped coefficients and a DC, plus the header and motion vectors.
+
+#define PLM_VIDEO_MACROBLOCK_MAX_BYTES 1536
+
 struct plm_video_t {
 	double framerate;
 	double time;
@@ -2560,6 +4397,8 @@ struct plm_video_t {
 	int chroma_width;
 	int chroma_height;
 
+	int scale_shift;
+
 	int start_code;
 	int picture_type;
 
@@ -2570,6 +4409,7 @@ struct plm_video_t {
 
 	int quantizer_scale;
 	int slice_begin;
+	int slice_end_address;
 	int macroblock_address;
 
 	int mb_row;
@@ -2586,17 +4426,77 @@ struct plm_video_t {
 	plm_frame_t frame_current;
 	plm_frame_t frame_forward;
 	plm_frame_t frame_backward;
+	plm_frame_t frame_next; // becomes frame_current after a reference picture
 
 	uint8_t *frames_data;
 
-	int block_data[64];
+	plm_video_alloc_frame_callback alloc_frame;
+	plm_video_release_frame_callback release_frame;
+	void *frame_callback_user_data;
+	int border;
+
+	int16_t block_data[64];
+	plm_video_batch_t *batch;
 	uint8_t intra_quant_matrix[64];
 	uint8_t non_intra_quant_matrix[64];
+	uint16_t intra_dequant[64];
+	uint16_t non_intra_dequant[64];
 
 	int has_reference_frame;
 	int assume_no_b_frames;
+
+	int skip_mode;
+	int skipped_references;
+
+	int incremental;
+	enum plm_video_progress progress;
+
+	void (*decode_macroblock)(plm_video_t *self);
+	void (*idct_put)(int16_t *block, uint8_t *dest, int dest_width);
+	void (*idct_add)(int16_t *block, uint8_t *dest, int dest_width);
+	void (*idct_put_4x4)(int16_t *block, uint8_t *dest, int dest_width);
+	void (*idct_add_4x4)(int16_t *block, uint8_t *dest, int dest_width);
+	const plm_video_mc_t *mc_luma;
+	const plm_video_mc_t *mc_chroma;
+
+	#ifdef PLM_PROFILE
+		plm_profile_t profile;
+	#endif
+
+	int threads;
+	#ifdef PLM_THREADS
+		plm_video_worker_t *workers;
+		plm_video_task_t *tasks;
+		int tasks_len;
+		int tasks_capacity;
+		int tasks_next;
+		plm_frame_t *b_frames;
+		uint8_t *b_frames_data;
+		int b_frames_len;
+		int b_frames_next;
+		pthread_mutex_t lock;
+		pthread_cond_t work_ready;
+		pthread_cond_t work_done;
+		int work_generation;
+		int workers_busy;
+		int workers_exit;
+	#endif
 };
 
+#ifdef PLM_THREADS
+	// Each worker decodes with its own copy of the decoder state, which reads
+	// from its own view of the shared buffer. Worker 0 is the calling thread
+	// and has no pthread of its own.
+
+	struct plm_video_worker_t {
+		plm_video_t *video;
+		plm_video_t context;
+		plm_buffer_t buffer;
+		plm_video_batch_t *batch;
+		pthread_t thread;
+	};
+#endif
+
 static inline uint8_t plm_clamp(int n) {
 	if (n > 255) {
 		n = 255;
@@ -2608,18 +4508,67 @@ static inline uint8_t plm_clamp(int n) {
 }
 
 int plm_video_decode_sequence_header(plm_video_t *self);
+void plm_video_init_frames(plm_video_t *self);
+void plm_video_drop_frames(plm_video_t *self);
+size_t plm_video_frame_data_size(plm_video_t *self);
 void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base);
+uint8_t *plm_video_init_plane(plm_plane_t *plane, int width, int height, int border, uint8_t *base);
+void plm_video_extend_edges(plm_frame_t *frame);
+void plm_video_extend_plane(plm_plane_t *plane, int border);
+void plm_video_alloc_frame(plm_video_t *self, plm_frame_t *frame);
+void plm_video_release_frame(plm_video_t *self, plm_frame_t *frame);
 void plm_video_decode_picture(plm_video_t *self);
-void plm_video_decode_slice(plm_video_t *self, int slice);
-void plm_video_decode_macroblock(plm_video_t *self);
-void plm_video_decode_motion_vectors(plm_video_t *self);
+int plm_video_begin_picture(plm_video_t *self);
+void plm_video_end_picture(plm_video_t *self);
+int plm_video_decode_picture_incremental(plm_video_t *self);
+int plm_video_has_macroblock(plm_video_t *self);
+void plm_video_decode_slices(plm_video_t *self);
+void plm_video_decode_slice(plm_video_t *self, int slice, int end_address, size_t end_bit_index);
+void plm_video_begin_slice(plm_video_t *self, int slice);
+int plm_video_slice_address(plm_video_t *self, int slice);
+int plm_video_read_address_increment(plm_video_t *self);
+void plm_video_decode_macroblock_i(plm_video_t *self);
+void plm_video_decode_macroblock_p(plm_video_t *self);
+void plm_video_decode_macroblock_b(plm_video_t *self);
+void plm_video_skip_forward(plm_video_t *self, int count);
+void plm_video_skip_bidirectional(plm_video_t *self, int count);
+void plm_video_copy_plane_rect(plm_plane_t *s, plm_plane_t *d, int x, int y, int width, int height);
+void plm_video_start_macroblock(plm_video_t *self, int intra);
+void plm_video_reconstruct_batch(plm_video_t *self);
 int plm_video_decode_motion_vector(plm_video_t *self, int r_size, int motion);
+int plm_video_motion_in_range(plm_video_t *self, int motion_h, int motion_v);
 void plm_video_predict_macroblock(plm_video_t *self);
+void plm_video_predict_forward(plm_video_t *self);
+void plm_video_predict_bidirectional(plm_video_t *self);
 void plm_video_copy_macroblock(plm_video_t *self, plm_frame_t *s, int motion_h, int motion_v);
 void plm_video_interpolate_macroblock(plm_video_t *self, plm_frame_t *s, int motion_h, int motion_v);
-void plm_video_process_macroblock(plm_video_t *self, uint8_t *s, uint8_t *d, int mh, int mb, int bs, int interp);
+void plm_video_process_macroblock(plm_video_t *self, uint8_t *s, uint8_t *d, int dw, int mh, int mb, int bs, int interp);
+void plm_video_set_quantizer_scale(plm_video_t *self, int quantizer_scale);
+void plm_video_update_dequant(plm_video_t *self);
 void plm_video_decode_block(plm_video_t *self, int block);
+int plm_video_decode_coefficients(plm_video_t *self, int block, int16_t *coeffs, int *support);
+void plm_video_reconstruct_block(plm_video_t *self, int block, int16_t *coeffs, int n, int support);
 void plm_video_idct(int *block);
+void plm_video_idct_row(int *row);
+void plm_video_idct_put(int16_t *block, uint8_t *dest, int dest_width);
+void plm_video_idct_add(int16_t *block, uint8_t *dest, int dest_width);
+void plm_video_idct_scaled(int16_t *block, uint8_t *dest, int dest_width, int size, int add);
+void plm_video_init_kernels(plm_video_t *self);
+void plm_video_stop_threads(plm_video_t *self);
+plm_frame_t *plm_video_picture_frame(plm_video_t *self);
+int plm_video_is_skipped(plm_video_t *self, int picture_type);
+plm_frame_t *plm_video_skip_picture(plm_video_t *self, int picture_type);
+void plm_video_skip_time(plm_video_t *self);
+
+#ifdef PLM_THREADS
+	void plm_video_decode_slices_parallel(plm_video_t *self);
+	plm_frame_t *plm_video_decode_b_pictures(plm_video_t *self);
+	plm_video_task_t *plm_video_add_task(plm_video_t *self, int slice, size_t bit_index, plm_frame_t *frame);
+	void plm_video_run_tasks(plm_video_t *self);
+	void plm_video_release_b_frames(plm_video_t *self);
+	void plm_video_worker_run(plm_video_worker_t *worker);
+	void *plm_video_worker_main(void *user);
+#endif
 
 plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
 	plm_video_t *self = (plm_video_t *)malloc(sizeof(plm_video_t));
@@ -2627,6 +4576,9 @@ plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_whe
 	
 	self->buffer = buffer;
 	self->destroy_buffer_when_done = destroy_when_done;
+	self->threads = 1;
+	self->border = PLM_VIDEO_BORDER;
+	plm_video_init_kernels(self);
 
 	// Attempt to decode the sequence header
 	self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_SEQUENCE);
@@ -2637,13 +4589,19 @@ plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_whe
 }
 
 void plm_video_destroy(plm_video_t *self) {
+	plm_video_stop_threads(self);
+
 	if (self->destroy_buffer_when_done) {
 		plm_buffer_destroy(self->buffer);
 	}
 
-	if (self->has_sequence_header) {
-		free(self->frames_data);
+	if (self->alloc_frame) {
+		plm_video_release_frame(self, &self->frame_current);
+		plm_video_release_frame(self, &self->frame_forward);
+		plm_video_release_frame(self, &self->frame_backward);
 	}
+	free(self->frames_data);
+	free(self->batch);
 
 	free(self);
 }
@@ -2656,13 +4614,13 @@ double plm_video_get_framerate(plm_video_t *self) {
 
 int plm_video_get_width(plm_video_t *self) {
 	return plm_video_has_header(self)
-		? self->width
+		? (self->width + (1 << self->scale_shift) - 1) >> self->scale_shift
 		: 0;
 }
 
 int plm_video_get_height(plm_video_t *self) {
 	return plm_video_has_header(self)
-		? self->height
+		? (self->height + (1 << self->scale_shift) - 1) >> self->scale_shift
 		: 0;
 }
 
@@ -2670,6 +4628,96 @@ void plm_video_set_no_delay(plm_video_t *self, int no_delay) {
 	self->assume_no_b_frames = no_delay;
 }
 
+void plm_video_set_frame_allocator(
+	plm_video_t *self, plm_video_alloc_frame_callback alloc,
+	plm_video_release_frame_callback release, void *user
+) {
+	self->alloc_frame = alloc;
+	self->release_frame = release;
+	self->frame_callback_user_data = user;
+	self->border = 0;
+
+	// The sequence header may have been decoded already
+	free(self->frames_data);
+	self->frames_data = NULL;
+	memset(&self->frame_current, 0, sizeof(plm_frame_t));
+	memset(&self->frame_forward, 0, sizeof(plm_frame_t));
+	memset(&self->frame_backward, 0, sizeof(plm_frame_t));
+}
+
+void plm_video_set_threads(plm_video_t *self, int threads) {
+	#ifdef PLM_THREADS
+		plm_video_stop_threads(self);
+		if (threads <= 1) {
+			return;
+		}
+
+		self->workers = (plm_video_worker_t *)malloc(sizeof(plm_video_worker_t) * threads);
+		memset(self->workers, 0, sizeof(plm_video_worker_t) * threads);
+		pthread_mutex_init(&self->lock, NULL);
+		pthread_cond_init(&self->work_ready, NULL);
+		pthread_cond_init(&self->work_done, NULL);
+		self->work_generation = 0;
+		self->workers_busy = 0;
+		self->workers_exit = FALSE;
+
+		self->threads = 1;
+		self->workers[0].video = self;
+		for (int i = 1; i < threads; i++) {
+			plm_video_worker_t *worker = &self->workers[i];
+			worker->video = self;
+			if (pthread_create(&worker->thread, NULL, plm_video_worker_main, worker) != 0) {
+				break;
+			}
+			self->threads++;
+		}
+	#else
+		PLM_UNUSED(self);
+		PLM_UNUSED(threads);
+	#endif
+}
+
+void plm_video_set_scale(plm_video_t *self, int scale) {
+	int shift = scale >= 8 ? 3 : scale >= 4 ? 2 : scale >= 2 ? 1 : 0;
+	if (shift == self->scale_shift) {
+		return;
+	}
+	self->scale_shift = shift;
+	plm_video_init_kernels(self);
+
+	// The sequence header may have been decoded already
+	if (self->has_sequence_header) {
+		plm_video_drop_frames(self);
+		plm_video_init_frames(self);
+	}
+}
+
+void plm_video_set_skip_mode(plm_video_t *self, int skip_mode) {
+	self->skip_mode = skip_mode;
+}
+
+int plm_video_get_incremental(plm_video_t *self) {
+	return self->incremental;
+}
+
+void plm_video_set_incremental(plm_video_t *self, int enabled) {
+	self->incremental = enabled;
+}
+
+int plm_video_get_two_pass(plm_video_t *self) {
+	return self->batch != NULL;
+}
+
+void plm_video_set_two_pass(plm_video_t *self, int enabled) {
+	if (enabled && !self->batch) {
+		self->batch = (plm_video_batch_t *)calloc(1, sizeof(plm_video_batch_t));
+	}
+	else if (!enabled && self->batch) {
+		free(self->batch);
+		self->batch = NULL;
+	}
+}
+
 double plm_video_get_time(plm_video_t *self) {
 	return self->time;
 }
@@ -2684,7 +4732,19 @@ void plm_video_rewind(plm_video_t *self) {
 	self->time = 0;
 	self->frames_decoded = 0;
 	self->has_reference_frame = FALSE;
+	self->skipped_references = 0;
 	self->start_code = -1;
+
+	// Drop what incremental decoding had of the current picture
+	self->progress = PLM_VIDEO_PROGRESS_NONE;
+	if (self->batch) {
+		memset(self->batch, 0, sizeof(plm_video_batch_t));
+	}
+
+	#ifdef PLM_THREADS
+		self->b_frames_len = 0;
+		self->b_frames_next = 0;
+	#endif
 }
 
 int plm_video_has_ended(plm_video_t *self) {
@@ -2697,7 +4757,24 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 	}
 	
 	plm_frame_t *frame = NULL;
-	do {
+
+	#ifdef PLM_THREADS
+		// Return B-pictures that were decoded ahead
+		if (self->b_frames_next < self->b_frames_len) {
+			frame = &self->b_frames[self->b_frames_next++];
+		}
+	#endif
+
+	while (!frame) {
+		if (self->progress != PLM_VIDEO_PROGRESS_NONE) {
+			// Carry on with the picture that incremental decoding started
+			if (!plm_video_decode_picture_incremental(self)) {
+				return NULL;
+			}
+			frame = plm_video_picture_frame(self);
+			continue;
+		}
+
 		if (self->start_code != PLM_START_PICTURE) {
 			self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_PICTURE);
 			
@@ -2706,6 +4783,7 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 				// frame was a reference frame, we still have to return it.
 				if (
 					self->has_reference_frame &&
+					!(self->skipped_references & 1) &&
 					!self->assume_no_b_frames &&
 					plm_buffer_has_ended(self->buffer) && (
 						self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
@@ -2725,30 +4803,53 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 		// decode it. Sadly, this can only be done by seeking for the start code
 		// of the next picture. Also, if we didn't find the start code for the
 		// next picture, but the source has ended, we assume that this last
-		// picture is in the buffer.
-		if (
+		// picture is in the buffer. Incremental decoding only needs the header.
+		if (self->incremental) {
+			if (!plm_buffer_has(self->buffer, 40) && !plm_buffer_has_ended(self->buffer)) {
+				return NULL;
+			}
+		}
+		else if (
 			plm_buffer_has_start_code(self->buffer, PLM_START_PICTURE) == -1 &&
 			!plm_buffer_has_ended(self->buffer)
 		) {
 			return NULL;
 		}
 		plm_buffer_discard_read_bytes(self->buffer);
-		
-		plm_video_decode_picture(self);
 
-		if (self->assume_no_b_frames) {
-			frame = &self->frame_backward;
+		// Peek at the picture_coding_type after the temporal reference
+		size_t bit_index = plm_buffer_get_bit_position(self->buffer);
+		plm_buffer_skip(self->buffer, 10);
+		int picture_type = plm_buffer_read(self->buffer, 3);
+		plm_buffer_set_bit_position(self->buffer, bit_index);
+		if (plm_video_is_skipped(self, picture_type)) {
+			frame = plm_video_skip_picture(self, picture_type);
+			self->start_code = -1;
+			continue;
 		}
-		else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
-			frame = &self->frame_current;
-		}
-		else if (self->has_reference_frame) {
-			frame = &self->frame_forward;
-		}
-		else {
-			self->has_reference_frame = TRUE;
+
+		if (self->incremental) {
+			if (!plm_video_decode_picture_incremental(self)) {
+				return NULL;
+			}
+			frame = plm_video_picture_frame(self);
+			continue;
 		}
-	} while (!frame);
+
+		#ifdef PLM_THREADS
+			// Consecutive B-pictures only reference the surrounding I/P-pictures,
+			// so several of them can be decoded at the same time.
+			if (self->threads > 1 && !self->assume_no_b_frames) {
+				frame = plm_video_decode_b_pictures(self);
+				if (frame) {
+					break;
+				}
+			}
+		#endif
+		
+		plm_video_decode_picture(self);
+		frame = plm_video_picture_frame(self);
+	}
 	
 	frame->time = self->time;
 	self->frames_decoded++;
@@ -2757,16 +4858,94 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 	return frame;
 }
 
-int plm_video_has_header(plm_video_t *self) {
-	if (self->has_sequence_header) {
-		return TRUE;
-	}
+#ifdef PLM_PROFILE
+plm_profile_t plm_video_get_profile(plm_video_t *self) {
+	plm_profile_t profile = self->profile;
+	plm_profile_add(&profile, &self->buffer->profile);
+	plm_profile_add(&profile, &plm_frame_profile);
+	memset(&self->profile, 0, sizeof(plm_profile_t));
+	memset(&self->buffer->profile, 0, sizeof(plm_profile_t));
+	memset(&plm_frame_profile, 0, sizeof(plm_profile_t));
+	return profile;
+}
+#endif
 
-	if (self->start_code != PLM_START_SEQUENCE) {
-		self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_SEQUENCE);
+// The frame to return after decoding a picture, if any. Reference pictures are
+// returned once the next one is decoded, unless there are no B-pictures.
+
+plm_frame_t *plm_video_picture_frame(plm_video_t *self) {
+	if (self->assume_no_b_frames) {
+		return &self->frame_backward;
 	}
-	if (self->start_code == -1) {
-		return FALSE;
+	else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
+		return &self->frame_current;
+	}
+	else if (self->skipped_references & 2) {
+		// The reference picture before this one was skipped, and its frame
+		// was returned already; see plm_video_skip_picture()
+		plm_video_skip_time(self);
+		return NULL;
+	}
+	else if (self->has_reference_frame) {
+		return &self->frame_forward;
+	}
+	self->has_reference_frame = TRUE;
+	return NULL;
+}
+
+// Whether a picture of this type is skipped, either by the skip mode or since
+// one of its references was. Bit 0 of skipped_references is the backward
+// reference, bit 1 the forward one.
+
+int plm_video_is_skipped(plm_video_t *self, int picture_type) {
+	if (picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
+		return self->skip_mode != PLM_VIDEO_SKIP_NONE || self->skipped_references;
+	}
+	if (picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+		return self->skip_mode == PLM_VIDEO_SKIP_NON_INTRA || (self->skipped_references & 1);
+	}
+	return FALSE;
+}
+
+// Skip a picture and keep the time of the returned frames in display order.
+// A B-picture would have been returned right away, so only its time passes.
+// A P-picture takes the place of the held back reference picture. That one is
+// returned now, where decoding the P-picture would have returned it, or its
+// time passes if it was skipped as well.
+
+plm_frame_t *plm_video_skip_picture(plm_video_t *self, int picture_type) {
+	if (picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
+		plm_video_skip_time(self);
+		return NULL;
+	}
+
+	self->skipped_references = ((self->skipped_references << 1) & 3) | 1;
+	if (self->assume_no_b_frames || (self->skipped_references & 2)) {
+		plm_video_skip_time(self);
+		return NULL;
+	}
+	if (!self->has_reference_frame) {
+		self->has_reference_frame = TRUE;
+		return NULL;
+	}
+	return &self->frame_backward;
+}
+
+void plm_video_skip_time(plm_video_t *self) {
+	self->frames_decoded++;
+	self->time = (double)self->frames_decoded / self->framerate;
+}
+
+int plm_video_has_header(plm_video_t *self) {
+	if (self->has_sequence_header) {
+		return TRUE;
+	}
+
+	if (self->start_code != PLM_START_SEQUENCE) {
+		self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_SEQUENCE);
+	}
+	if (self->start_code == -1) {
+		return FALSE;
 	}
 	
 	if (!plm_video_decode_sequence_header(self)) {
@@ -2818,59 +4997,199 @@ int plm_video_decode_sequence_header(plm_video_t *self) {
 	else {
 		memcpy(self->non_intra_quant_matrix, PLM_VIDEO_NON_INTRA_QUANT_MATRIX, 64);
 	}
+	plm_video_update_dequant(self);
 
 	self->mb_width = (self->width + 15) >> 4;
 	self->mb_height = (self->height + 15) >> 4;
 	self->mb_size = self->mb_width * self->mb_height;
 
-	self->luma_width = self->mb_width << 4;
-	self->luma_height = self->mb_height << 4;
+	plm_video_init_frames(self);
 
-	self->chroma_width = self->mb_width << 3;
-	self->chroma_height = self->mb_height << 3;
+	self->has_sequence_header = TRUE;
+	return TRUE;
+}
 
+// Set the plane sizes for the current scale, and allocate one big chunk of
+// data for all 3 frames = 9 planes. With a frame allocator, frames are
+// allocated per picture instead.
 
-	// Allocate one big chunk of data for all 3 frames = 9 planes
-	size_t luma_plane_size = self->luma_width * self->luma_height;
-	size_t chroma_plane_size = self->chroma_width * self->chroma_height;
-	size_t frame_data_size = (luma_plane_size + 2 * chroma_plane_size);
+void plm_video_init_frames(plm_video_t *self) {
+	self->luma_width = self->mb_width << (4 - self->scale_shift);
+	self->luma_height = self->mb_height << (4 - self->scale_shift);
 
-	self->frames_data = (uint8_t*)malloc(frame_data_size * 3);
-	plm_video_init_frame(self, &self->frame_current, self->frames_data + frame_data_size * 0);
-	plm_video_init_frame(self, &self->frame_forward, self->frames_data + frame_data_size * 1);
-	plm_video_init_frame(self, &self->frame_backward, self->frames_data + frame_data_size * 2);
+	self->chroma_width = self->mb_width << (3 - self->scale_shift);
+	self->chroma_height = self->mb_height << (3 - self->scale_shift);
 
-	self->has_sequence_header = TRUE;
-	return TRUE;
+	free(self->frames_data);
+	self->frames_data = NULL;
+	if (!self->alloc_frame) {
+		size_t frame_data_size = plm_video_frame_data_size(self);
+		self->frames_data = (uint8_t*)malloc(frame_data_size * 3 + 31);
+		uint8_t *base = (uint8_t *)(((uintptr_t)self->frames_data + 31) & ~(uintptr_t)31);
+		plm_video_init_frame(self, &self->frame_current, base + frame_data_size * 0);
+		plm_video_init_frame(self, &self->frame_forward, base + frame_data_size * 1);
+		plm_video_init_frame(self, &self->frame_backward, base + frame_data_size * 2);
+	}
+}
+
+// Drop the frames decoded so far, before they're set up again at another
+// scale. Their time still passes, and the pictures that reference them are
+// skipped until the next I-picture; see plm_video_skip_picture().
+
+void plm_video_drop_frames(plm_video_t *self) {
+	// Skip the picture that incremental decoding started, and the reference
+	// picture that's held back
+	if (self->progress != PLM_VIDEO_PROGRESS_NONE) {
+		if (plm_video_skip_picture(self, self->picture_type)) {
+			plm_video_skip_time(self);
+		}
+		self->progress = PLM_VIDEO_PROGRESS_NONE;
+		self->start_code = -1;
+		if (self->batch) {
+			memset(self->batch, 0, sizeof(plm_video_batch_t));
+		}
+	}
+	if (self->has_reference_frame) {
+		self->skipped_references |= 1;
+	}
+
+	if (self->alloc_frame) {
+		plm_video_release_frame(self, &self->frame_current);
+		plm_video_release_frame(self, &self->frame_forward);
+		plm_video_release_frame(self, &self->frame_backward);
+	}
+
+	#ifdef PLM_THREADS
+		while (self->b_frames_next < self->b_frames_len) {
+			self->b_frames_next++;
+			plm_video_skip_time(self);
+		}
+		plm_video_release_b_frames(self);
+	#endif
 }
 
+// The size of a frame with borders; see plm_video_init_plane()
+
+size_t plm_video_frame_data_size(plm_video_t *self) {
+	size_t luma_stride = (self->luma_width + 2 * PLM_VIDEO_BORDER + 31) & ~31;
+	size_t chroma_stride = (self->chroma_width + PLM_VIDEO_BORDER + 31) & ~31;
+	return
+		luma_stride * (self->luma_height + 2 * PLM_VIDEO_BORDER) +
+		chroma_stride * (self->chroma_height + PLM_VIDEO_BORDER) * 2;
+}
+
+// Set up a frame in the memory at base, with borders. If base is NULL, only
+// the sizes are set, for the frame allocator.
+
 void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base) {
-	size_t luma_plane_size = self->luma_width * self->luma_height;
-	size_t chroma_plane_size = self->chroma_width * self->chroma_height;
+	int round = (1 << self->scale_shift) - 1;
+	frame->width = (self->width + round) >> self->scale_shift;
+	frame->height = (self->height + round) >> self->scale_shift;
+	frame->user = NULL;
+
+	int border = base ? PLM_VIDEO_BORDER : 0;
+	base = plm_video_init_plane(&frame->y, self->luma_width, self->luma_height, border, base);
+	base = plm_video_init_plane(&frame->cr, self->chroma_width, self->chroma_height, border / 2, base);
+	base = plm_video_init_plane(&frame->cb, self->chroma_width, self->chroma_height, border / 2, base);
+}
 
-	frame->width = self->width;
-	frame->height = self->height;
-	frame->y.width = self->luma_width;
-	frame->y.height = self->luma_height;
-	frame->y.data = base;
+// Returns where the next plane starts
 
-	frame->cr.width = self->chroma_width;
-	frame->cr.height = self->chroma_height;
-	frame->cr.data = base + luma_plane_size;
+uint8_t *plm_video_init_plane(plm_plane_t *plane, int width, int height, int border, uint8_t *base) {
+	plane->width = width;
+	plane->height = height;
+	if (!base) {
+		plane->stride = width;
+		plane->data = NULL;
+		return NULL;
+	}
+	plane->stride = (width + 2 * border + 31) & ~31;
+	plane->data = base + border * plane->stride + border;
+	return base + plane->stride * (height + 2 * border);
+}
+
+// Replicate the edge pixels of a reference frame into its border, so motion
+// vectors that point a little outside the picture still predict something
+// sensible. This runs once per reference picture.
 
-	frame->cb.width = self->chroma_width;
-	frame->cb.height = self->chroma_height;
-	frame->cb.data = base + luma_plane_size + chroma_plane_size;
+void plm_video_extend_edges(plm_frame_t *frame) {
+	plm_video_extend_plane(&frame->y, PLM_VIDEO_BORDER);
+	plm_video_extend_plane(&frame->cr, PLM_VIDEO_BORDER / 2);
+	plm_video_extend_plane(&frame->cb, PLM_VIDEO_BORDER / 2);
+}
+
+void plm_video_extend_plane(plm_plane_t *plane, int border) {
+	int stride = plane->stride;
+	uint8_t *row = plane->data;
+	for (unsigned int y = 0; y < plane->height; y++) {
+		memset(row - border, row[0], border);
+		memset(row + plane->width, row[plane->width - 1], border);
+		row += stride;
+	}
+
+	uint8_t *first = plane->data - border;
+	uint8_t *last = first + (plane->height - 1) * stride;
+	for (int y = 1; y <= border; y++) {
+		memcpy(first - y * stride, first, plane->width + 2 * border);
+		memcpy(last + y * stride, last, plane->width + 2 * border);
+	}
+}
+
+// Get a new frame from the frame allocator, releasing the one that was there
+
+void plm_video_alloc_frame(plm_video_t *self, plm_frame_t *frame) {
+	plm_video_release_frame(self, frame);
+	plm_video_init_frame(self, frame, NULL);
+	self->alloc_frame(self, frame, self->frame_callback_user_data);
+}
+
+void plm_video_release_frame(plm_video_t *self, plm_frame_t *frame) {
+	if (frame->y.data) {
+		self->release_frame(self, frame, self->frame_callback_user_data);
+		memset(frame, 0, sizeof(plm_frame_t));
+	}
 }
 
 void plm_video_decode_picture(plm_video_t *self) {
+	PLM_PROFILE_BEGIN(profile_start);
+	if (!plm_video_begin_picture(self)) {
+		return;
+	}
+
+	// Find first slice start code; skip extension and user data
+	do {
+		self->start_code = plm_buffer_next_start_code(self->buffer);
+	} while (
+		self->start_code == PLM_START_EXTENSION || 
+		self->start_code == PLM_START_USER_DATA
+	);
+
+	#ifdef PLM_THREADS
+		if (self->threads > 1) {
+			plm_video_decode_slices_parallel(self);
+		}
+		else {
+			plm_video_decode_slices(self);
+		}
+	#else
+		plm_video_decode_slices(self);
+	#endif
+
+	plm_video_end_picture(self);
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO, profile_start);
+}
+
+// Read the picture header and set up the frames. Returns FALSE for pictures
+// that are ignored.
+
+int plm_video_begin_picture(plm_video_t *self) {
 	plm_buffer_skip(self->buffer, 10); // skip temporalReference
 	self->picture_type = plm_buffer_read(self->buffer, 3);
 	plm_buffer_skip(self->buffer, 16); // skip vbv_delay
 
 	// D frames or unknown coding type
 	if (self->picture_type <= 0 || self->picture_type > PLM_VIDEO_PICTURE_TYPE_B) {
-		return;
+		return FALSE;
 	}
 
 	// Forward full_px, f_code
@@ -2882,7 +5201,7 @@ void plm_video_decode_picture(plm_video_t *self) {
 		int f_code = plm_buffer_read(self->buffer, 3);
 		if (f_code == 0) {
 			// Ignore picture with zero f_code
-			return;
+			return FALSE;
 		}
 		self->motion_forward.r_size = f_code - 1;
 	}
@@ -2893,12 +5212,23 @@ void plm_video_decode_picture(plm_video_t *self) {
 		int f_code = plm_buffer_read(self->buffer, 3);
 		if (f_code == 0) {
 			// Ignore picture with zero f_code
-			return;
+			return FALSE;
 		}
 		self->motion_backward.r_size = f_code - 1;
 	}
 
-	plm_frame_t frame_temp = self->frame_forward;
+	// Pick the macroblock decoder once for the whole picture
+	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA) {
+		self->decode_macroblock = plm_video_decode_macroblock_i;
+	}
+	else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+		self->decode_macroblock = plm_video_decode_macroblock_p;
+	}
+	else {
+		self->decode_macroblock = plm_video_decode_macroblock_b;
+	}
+
+	self->frame_next = self->frame_forward;
 	if (
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE
@@ -2906,35 +5236,521 @@ void plm_video_decode_picture(plm_video_t *self) {
 		self->frame_forward = self->frame_backward;
 	}
 
+	if (self->alloc_frame) {
+		// The previous frame_current was either a B-picture that has been
+		// returned, or the forward reference that is no longer needed
+		if (
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE
+		) {
+			plm_video_release_frame(self, &self->frame_next);
+		}
+		plm_video_alloc_frame(self, &self->frame_current);
 
-	// Find first slice start code; skip extension and user data
-	do {
-		self->start_code = plm_buffer_next_start_code(self->buffer);
-	} while (
-		self->start_code == PLM_START_EXTENSION || 
-		self->start_code == PLM_START_USER_DATA
-	);
-
-	// Decode all slices
-	while (PLM_START_IS_SLICE(self->start_code)) {
-		plm_video_decode_slice(self, self->start_code & 0x000000FF);
-		if (self->macroblock_address >= self->mb_size - 2) {
-			break;
+		// References are missing if the stream didn't start with an I-picture.
+		// Corrupt I-pictures may skip macroblocks, which predicts them too.
+		if (!self->frame_forward.y.data) {
+			plm_video_alloc_frame(self, &self->frame_forward);
+		}
+		if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B && !self->frame_backward.y.data) {
+			plm_video_alloc_frame(self, &self->frame_backward);
 		}
-		self->start_code = plm_buffer_next_start_code(self->buffer);
 	}
 
-	// If this is a reference picture rotate the prediction pointers
+	return TRUE;
+}
+
+// Finish a decoded picture; if it's a reference picture, rotate the prediction
+// pointers.
+
+void plm_video_end_picture(plm_video_t *self) {
 	if (
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA ||
 		self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE
 	) {
+		if (self->border) {
+			plm_video_extend_edges(&self->frame_current);
+		}
+		self->skipped_references = (self->skipped_references << 1) & 3;
 		self->frame_backward = self->frame_current;
-		self->frame_current = frame_temp;
+		self->frame_current = self->frame_next;
+		if (self->alloc_frame) {
+			memset(&self->frame_current, 0, sizeof(plm_frame_t));
+		}
+	}
+}
+
+// Decode as much of the current picture as the buffer has, carrying on where
+// the last call left off. Returns TRUE once the picture is complete, FALSE if
+// it needs more data. This follows plm_video_decode_picture() and
+// plm_video_decode_slices(), one step at a time.
+
+int plm_video_decode_picture_incremental(plm_video_t *self) {
+	PLM_PROFILE_BEGIN(profile_start);
+	plm_buffer_discard_read_bytes(self->buffer);
+	if (self->progress == PLM_VIDEO_PROGRESS_NONE) {
+		if (!plm_video_begin_picture(self)) {
+			return TRUE;
+		}
+		self->progress = PLM_VIDEO_PROGRESS_FIRST_SLICE;
 	}
+
+	while (TRUE) {
+		if (
+			self->progress == PLM_VIDEO_PROGRESS_FIRST_SLICE ||
+			self->progress == PLM_VIDEO_PROGRESS_SLICES
+		) {
+			// Find the next slice start code; skip extension and user data
+			// before the first one
+			self->start_code = plm_buffer_next_start_code(self->buffer);
+			if (self->start_code == -1 && !plm_buffer_has_ended(self->buffer)) {
+				PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO, profile_start);
+				return FALSE;
+			}
+			if (
+				self->progress == PLM_VIDEO_PROGRESS_FIRST_SLICE && (
+					self->start_code == PLM_START_EXTENSION ||
+					self->start_code == PLM_START_USER_DATA
+				)
+			) {
+				continue;
+			}
+			if (!PLM_START_IS_SLICE(self->start_code)) {
+				break;
+			}
+			self->progress = PLM_VIDEO_PROGRESS_SLICE_BEGIN;
+		}
+
+		// The last macroblock ends the picture without looking any further
+		int slice_end =
+			self->progress == PLM_VIDEO_PROGRESS_MACROBLOCKS &&
+			self->macroblock_address >= self->mb_size - 1;
+		if (!slice_end && !plm_video_has_macroblock(self)) {
+			PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO, profile_start);
+			return FALSE;
+		}
+
+		if (self->progress == PLM_VIDEO_PROGRESS_SLICE_BEGIN) {
+			// The next start code may not be here yet; slices aren't bounded
+			self->slice_end_address = self->mb_size;
+			plm_video_begin_slice(self, self->start_code & 0x000000FF);
+			self->decode_macroblock(self);
+			self->progress = PLM_VIDEO_PROGRESS_MACROBLOCKS;
+		}
+		else if (!slice_end && plm_buffer_peek_non_zero(self->buffer, 23)) {
+			self->decode_macroblock(self);
+		}
+		else {
+			// End of the slice
+			if (self->batch) {
+				plm_video_reconstruct_batch(self);
+			}
+			if (self->macroblock_address >= self->mb_size - 1) {
+				break;
+			}
+			self->progress = PLM_VIDEO_PROGRESS_SLICES;
+		}
+	}
+
+	plm_video_end_picture(self);
+	self->progress = PLM_VIDEO_PROGRESS_NONE;
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO, profile_start);
+	return TRUE;
+}
+
+// Whether the next macroblock can be decoded without running out of data: it
+// surely fits into what's left, the start code after its slice is there, or
+// no more data will come.
+
+int plm_video_has_macroblock(plm_video_t *self) {
+	if (plm_buffer_get_remaining(self->buffer) >= PLM_VIDEO_MACROBLOCK_MAX_BYTES) {
+		return TRUE;
+	}
+	if (plm_buffer_has_start_code(self->buffer, PLM_BUFFER_ANY_START_CODE) != -1) {
+		return TRUE;
+	}
+
+	// Looking for the start code may have loaded more data
+	return
+		plm_buffer_get_remaining(self->buffer) >= PLM_VIDEO_MACROBLOCK_MAX_BYTES ||
+		plm_buffer_has_ended(self->buffer);
+}
+
+// A slice's data ends at the next start code, and it doesn't reach the first
+// macroblock of the slice that follows, even when corrupt; this is what lets
+// plm_video_decode_slices_parallel() decode them independently with the same
+// result. So before each slice, find the next start code and where the slice
+// after it begins.
+
+void plm_video_decode_slices(plm_video_t *self) {
+	plm_buffer_t *buffer = self->buffer;
+
+	// Keep the bit positions stable, in case the load callback adds more data
+	int previous_discard_read_bytes = buffer->discard_read_bytes;
+	buffer->discard_read_bytes = FALSE;
+
+	while (PLM_START_IS_SLICE(self->start_code)) {
+		int slice = self->start_code & 0x000000FF;
+		size_t bit_index = plm_buffer_get_bit_position(buffer);
+
+		int next_start_code = plm_buffer_next_start_code(buffer);
+		size_t next_bit_index = plm_buffer_get_bit_position(buffer);
+		size_t end_bit_index = next_start_code != -1
+			? next_bit_index - 32
+			: SIZE_MAX;
+		int end_address = PLM_START_IS_SLICE(next_start_code)
+			? plm_video_slice_address(self, next_start_code)
+			: self->mb_size;
+
+		plm_buffer_set_bit_position(buffer, bit_index);
+		plm_video_decode_slice(self, slice, end_address, end_bit_index);
+		if (self->macroblock_address >= self->mb_size - 1) {
+			break;
+		}
+		plm_buffer_set_bit_position(buffer, next_bit_index);
+		self->start_code = next_start_code;
+	}
+
+	buffer->discard_read_bytes = previous_discard_read_bytes;
 }
 
-void plm_video_decode_slice(plm_video_t *self, int slice) {
+#ifdef PLM_THREADS
+
+// Slices reset the DC predictors and motion vectors, so once their offsets
+// are known they can be decoded in any order. plm_video_decode() made sure the
+// whole picture is in the buffer; it's scanned up to the first start code that
+// isn't a slice, which is where the sequential loop leaves off as well. Each
+// slice only writes up to where the next one starts, see
+// plm_video_decode_slices(); if they don't start in increasing order, which
+// only happens in corrupt streams, the picture is decoded sequentially.
+
+void plm_video_decode_slices_parallel(plm_video_t *self) {
+	plm_buffer_t *buffer = self->buffer;
+
+	// Keep the byte offsets stable while looking for the slices, in case the
+	// load callback adds more data.
+	int previous_discard_read_bytes = buffer->discard_read_bytes;
+	buffer->discard_read_bytes = FALSE;
+
+	int first_start_code = self->start_code;
+	size_t first_bit_index = plm_buffer_get_bit_position(buffer);
+	int increasing = TRUE;
+
+	self->tasks_len = 0;
+	while (PLM_START_IS_SLICE(self->start_code)) {
+		plm_video_task_t *task = plm_video_add_task(
+			self, self->start_code & 0x000000FF, plm_buffer_get_bit_position(buffer), NULL
+		);
+		task->address = plm_video_slice_address(self, task->slice);
+		if (self->tasks_len > 1) {
+			plm_video_task_t *previous = task - 1;
+			increasing = increasing && previous->address < task->address;
+			previous->end_address = task->address;
+			previous->end_bit_index = task->bit_index - 32;
+		}
+		self->start_code = plm_buffer_next_start_code(buffer);
+	}
+	if (self->tasks_len > 0) {
+		plm_video_task_t *last = &self->tasks[self->tasks_len - 1];
+		last->end_address = self->mb_size;
+		last->end_bit_index = self->start_code != -1
+			? plm_buffer_get_bit_position(buffer) - 32
+			: SIZE_MAX;
+	}
+
+	buffer->discard_read_bytes = previous_discard_read_bytes;
+	if (!increasing) {
+		plm_buffer_set_bit_position(buffer, first_bit_index);
+		self->start_code = first_start_code;
+		plm_video_decode_slices(self);
+		return;
+	}
+	plm_video_run_tasks(self);
+}
+
+// Decode the run of B-pictures starting at the current picture start code,
+// one per thread, as far as they are complete in the buffer. Returns the
+// first of them, or NULL if there aren't at least two; the current picture is
+// then decoded as usual. Afterwards the buffer is left where decoding the
+// last of them sequentially would have left it.
+
+plm_frame_t *plm_video_decode_b_pictures(plm_video_t *self) {
+	plm_buffer_t *buffer = self->buffer;
+	size_t start = plm_buffer_get_bit_position(buffer);
+	int previous_discard_read_bytes = buffer->discard_read_bytes;
+	buffer->discard_read_bytes = FALSE;
+
+	if (!self->b_frames) {
+		self->b_frames = (plm_frame_t *)malloc(sizeof(plm_frame_t) * self->threads);
+		memset(self->b_frames, 0, sizeof(plm_frame_t) * self->threads);
+		if (!self->alloc_frame) {
+			size_t frame_data_size = plm_video_frame_data_size(self);
+			self->b_frames_data = (uint8_t *)malloc(frame_data_size * self->threads + 31);
+			uint8_t *base = (uint8_t *)(((uintptr_t)self->b_frames_data + 31) & ~(uintptr_t)31);
+			for (int i = 0; i < self->threads; i++) {
+				plm_video_init_frame(self, &self->b_frames[i], base + frame_data_size * i);
+			}
+		}
+	}
+
+	self->tasks_len = 0;
+	while (self->tasks_len < self->threads && plm_buffer_has(buffer, 13)) {
+		// Peek at the picture_coding_type after the temporal reference
+		size_t bit_index = plm_buffer_get_bit_position(buffer);
+		plm_buffer_skip(buffer, 10);
+		int picture_type = plm_buffer_read(buffer, 3);
+		plm_buffer_set_bit_position(buffer, bit_index);
+		if (picture_type != PLM_VIDEO_PICTURE_TYPE_B) {
+			break;
+		}
+
+		// Only take the picture if it's complete; see plm_video_decode()
+		int next = plm_buffer_find_start_code(buffer, PLM_START_PICTURE);
+		if (next == -1 && !plm_buffer_has_ended(buffer)) {
+			break;
+		}
+		plm_video_add_task(self, 0, bit_index, &self->b_frames[self->tasks_len]);
+		if (next == -1) {
+			break;
+		}
+	}
+
+	plm_buffer_set_bit_position(buffer, start);
+	buffer->discard_read_bytes = previous_discard_read_bytes;
+	if (self->tasks_len < 2) {
+		return NULL;
+	}
+
+	// The frames from the previous run have all been returned by now. The
+	// workers must not allocate anything; see plm_video_decode_picture().
+	if (self->alloc_frame) {
+		for (int i = 0; i < self->tasks_len; i++) {
+			plm_video_alloc_frame(self, &self->b_frames[i]);
+		}
+		for (int i = self->tasks_len; i < self->threads; i++) {
+			plm_video_release_frame(self, &self->b_frames[i]);
+		}
+		if (!self->frame_forward.y.data) {
+			plm_video_alloc_frame(self, &self->frame_forward);
+		}
+		if (!self->frame_backward.y.data) {
+			plm_video_alloc_frame(self, &self->frame_backward);
+		}
+	}
+
+	plm_video_run_tasks(self);
+
+	plm_video_task_t *last = &self->tasks[self->tasks_len - 1];
+	plm_buffer_set_bit_position(buffer, last->end_bit_index);
+	self->start_code = last->end_start_code;
+	self->picture_type = PLM_VIDEO_PICTURE_TYPE_B;
+
+	self->b_frames_len = self->tasks_len;
+	self->b_frames_next = 1;
+	return &self->b_frames[0];
+}
+
+plm_video_task_t *plm_video_add_task(plm_video_t *self, int slice, size_t bit_index, plm_frame_t *frame) {
+	if (self->tasks_len == self->tasks_capacity) {
+		self->tasks_capacity = self->tasks_capacity ? self->tasks_capacity * 2 : 64;
+		self->tasks = (plm_video_task_t *)realloc(
+			self->tasks, sizeof(plm_video_task_t) * self->tasks_capacity
+		);
+	}
+	plm_video_task_t *task = &self->tasks[self->tasks_len++];
+	task->slice = slice;
+	task->bit_index = bit_index;
+	task->frame = frame;
+	task->address = 0;
+	task->end_address = self->mb_size;
+	task->end_bit_index = SIZE_MAX;
+	task->end_start_code = -1;
+	return task;
+}
+
+// Set up each worker with a copy of the picture state and a view of the buffer
+// that doesn't load or discard anything, then work through the tasks on all
+// threads.
+
+void plm_video_run_tasks(plm_video_t *self) {
+	for (int i = 0; i < self->threads; i++) {
+		plm_video_worker_t *worker = &self->workers[i];
+		worker->context = *self;
+		worker->context.buffer = &worker->buffer;
+		worker->context.threads = 1;
+		worker->context.alloc_frame = NULL;
+		worker->context.release_frame = NULL;
+		if (self->batch) {
+			if (!worker->batch) {
+				worker->batch = (plm_video_batch_t *)calloc(1, sizeof(plm_video_batch_t));
+			}
+			worker->context.batch = worker->batch;
+		}
+
+		worker->buffer = *self->buffer;
+		if (worker->buffer.mode != PLM_BUFFER_MODE_CHUNKS) {
+			worker->buffer.mode = PLM_BUFFER_MODE_FIXED_MEM;
+			worker->buffer.total_size = self->buffer->length;
+		}
+		worker->buffer.discard_read_bytes = FALSE;
+		worker->buffer.load_callback = NULL;
+		worker->buffer.fh = NULL;
+
+		#ifdef PLM_PROFILE
+			memset(&worker->context.profile, 0, sizeof(plm_profile_t));
+			memset(&worker->buffer.profile, 0, sizeof(plm_profile_t));
+		#endif
+	}
+
+	pthread_mutex_lock(&self->lock);
+	self->tasks_next = 0;
+	self->workers_busy = self->threads - 1;
+	self->work_generation++;
+	pthread_cond_broadcast(&self->work_ready);
+	pthread_mutex_unlock(&self->lock);
+
+	plm_video_worker_run(&self->workers[0]);
+
+	pthread_mutex_lock(&self->lock);
+	while (self->workers_busy > 0) {
+		pthread_cond_wait(&self->work_done, &self->lock);
+	}
+	pthread_mutex_unlock(&self->lock);
+
+	#ifdef PLM_PROFILE
+		for (int i = 0; i < self->threads; i++) {
+			plm_profile_add(&self->profile, &self->workers[i].context.profile);
+			plm_profile_add(&self->buffer->profile, &self->workers[i].buffer.profile);
+		}
+	#endif
+}
+
+void plm_video_worker_run(plm_video_worker_t *worker) {
+	plm_video_t *self = worker->video;
+	while (TRUE) {
+		pthread_mutex_lock(&self->lock);
+		int next = self->tasks_next++;
+		pthread_mutex_unlock(&self->lock);
+
+		if (next >= self->tasks_len) {
+			return;
+		}
+
+		plm_video_task_t *task = &self->tasks[next];
+		plm_buffer_set_bit_position(&worker->buffer, task->bit_index);
+		if (task->frame) {
+			worker->context.frame_current = *task->frame;
+			plm_video_decode_picture(&worker->context);
+			task->end_bit_index = plm_buffer_get_bit_position(&worker->buffer);
+			task->end_start_code = worker->context.start_code;
+		}
+		else {
+			plm_video_decode_slice(&worker->context, task->slice, task->end_address, task->end_bit_index);
+		}
+	}
+}
+
+void *plm_video_worker_main(void *user) {
+	plm_video_worker_t *worker = (plm_video_worker_t *)user;
+	plm_video_t *self = worker->video;
+
+	// The work generation starts at 0 in plm_video_set_threads(); anything
+	// above that may have been posted before this thread got to run.
+	int generation = 0;
+	pthread_mutex_lock(&self->lock);
+	while (TRUE) {
+		while (self->work_generation == generation && !self->workers_exit) {
+			pthread_cond_wait(&self->work_ready, &self->lock);
+		}
+		if (self->workers_exit) {
+			break;
+		}
+		generation = self->work_generation;
+		pthread_mutex_unlock(&self->lock);
+
+		plm_video_worker_run(worker);
+
+		pthread_mutex_lock(&self->lock);
+		self->workers_busy--;
+		if (self->workers_busy == 0) {
+			pthread_cond_signal(&self->work_done);
+		}
+	}
+	pthread_mutex_unlock(&self->lock);
+	return NULL;
+}
+
+// Release the frames of B-pictures decoded ahead; they're set up again by the
+// next plm_video_decode_b_pictures().
+
+void plm_video_release_b_frames(plm_video_t *self) {
+	if (self->b_frames && self->alloc_frame) {
+		for (int i = 0; i < self->threads; i++) {
+			plm_video_release_frame(self, &self->b_frames[i]);
+		}
+	}
+	free(self->b_frames);
+	free(self->b_frames_data);
+	self->b_frames = NULL;
+	self->b_frames_data = NULL;
+	self->b_frames_len = 0;
+	self->b_frames_next = 0;
+}
+
+#endif // PLM_THREADS
+
+void plm_video_stop_threads(plm_video_t *self) {
+	#ifdef PLM_THREADS
+		if (!self->workers) {
+			return;
+		}
+
+		pthread_mutex_lock(&self->lock);
+		self->workers_exit = TRUE;
+		pthread_cond_broadcast(&self->work_ready);
+		pthread_mutex_unlock(&self->lock);
+
+		for (int i = 1; i < self->threads; i++) {
+			pthread_join(self->workers[i].thread, NULL);
+		}
+
+		pthread_cond_destroy(&self->work_done);
+		pthread_cond_destroy(&self->work_ready);
+		pthread_mutex_destroy(&self->lock);
+		plm_video_release_b_frames(self);
+		for (int i = 0; i < self->threads; i++) {
+			free(self->workers[i].batch);
+		}
+		free(self->workers);
+		free(self->tasks);
+		self->workers = NULL;
+		self->tasks = NULL;
+		self->tasks_capacity = 0;
+	#endif
+	self->threads = 1;
+}
+
+void plm_video_decode_slice(plm_video_t *self, int slice, int end_address, size_t end_bit_index) {
+	self->slice_end_address = end_address < self->mb_size ? end_address : self->mb_size;
+	plm_video_begin_slice(self, slice);
+
+	do {
+		self->decode_macroblock(self);
+	} while (
+		self->macroblock_address < self->slice_end_address - 1 &&
+		plm_buffer_get_bit_position(self->buffer) < end_bit_index &&
+		plm_buffer_peek_non_zero(self->buffer, 23)
+	);
+
+	if (self->batch) {
+		plm_video_reconstruct_batch(self);
+	}
+	if (plm_buffer_get_bit_position(self->buffer) > end_bit_index) {
+		plm_buffer_set_bit_position(self->buffer, end_bit_index);
+	}
+}
+
+void plm_video_begin_slice(plm_video_t *self, int slice) {
 	self->slice_begin = TRUE;
 	self->macroblock_address = (slice - 1) * self->mb_width - 1;
 
@@ -2945,145 +5761,303 @@ void plm_video_decode_slice(plm_video_t *self, int slice) {
 	self->dc_predictor[1] = 128;
 	self->dc_predictor[2] = 128;
 
-	self->quantizer_scale = plm_buffer_read(self->buffer, 5);
+	plm_video_set_quantizer_scale(self, plm_buffer_read(self->buffer, 5));
 
 	// Skip extra
 	while (plm_buffer_read(self->buffer, 1)) {
 		plm_buffer_skip(self->buffer, 8);
 	}
+}
 
-	do {
-		plm_video_decode_macroblock(self);
-	} while (
-		self->macroblock_address < self->mb_size - 1 &&
-		plm_buffer_peek_non_zero(self->buffer, 23)
-	);
+// The address of the first macroblock of a slice, from its vertical position
+// and the first address increment after the header at the current position.
+// This only peeks; the position stays where it is.
+
+int plm_video_slice_address(plm_video_t *self, int slice) {
+	size_t bit_index = plm_buffer_get_bit_position(self->buffer);
+	plm_buffer_skip(self->buffer, 5); // quantizer_scale
+	while (plm_buffer_read(self->buffer, 1)) {
+		plm_buffer_skip(self->buffer, 8);
+	}
+	int increment = plm_video_read_address_increment(self);
+	plm_buffer_set_bit_position(self->buffer, bit_index);
+	return (slice - 1) * self->mb_width - 1 + increment;
 }
 
-void plm_video_decode_macroblock(plm_video_t *self) {
-	// Decode increment
+int plm_video_read_address_increment(plm_video_t *self) {
 	int increment = 0;
-	int t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+	int t = plm_buffer_read_vlc(self->buffer, &PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
 
 	while (t == 34) {
 		// macroblock_stuffing
-		t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+		t = plm_buffer_read_vlc(self->buffer, &PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
 	}
 	while (t == 35) {
 		// macroblock_escape
 		increment += 33;
-		t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+		t = plm_buffer_read_vlc(self->buffer, &PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
 	}
-	increment += t;
-
-	// Process any skipped macroblocks
-	if (self->slice_begin) {
-		// The first increment of each slice is relative to beginning of the
-		// previous row, not the previous macroblock
-		self->slice_begin = FALSE;
-		self->macroblock_address += increment;
-	}
-	else {
-		if (self->macroblock_address + increment >= self->mb_size) {
-			return; // invalid
-		}
-		if (increment > 1) {
-			// Skipped macroblocks reset DC predictors
-			self->dc_predictor[0] = 128;
-			self->dc_predictor[1] = 128;
-			self->dc_predictor[2] = 128;
-
-			// Skipped macroblocks in P-pictures reset motion vectors
-			if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
-				self->motion_forward.h = 0;
-				self->motion_forward.v = 0;
-			}
-		}
+	return increment + t;
+}
 
-		// Predict skipped macroblocks
-		while (increment > 1) {
-			self->macroblock_address++;
-			self->mb_row = self->macroblock_address / self->mb_width;
-			self->mb_col = self->macroblock_address % self->mb_width;
+static inline void plm_video_decode_motion_vectors(plm_video_t *self, int picture_type) {
 
-			plm_video_predict_macroblock(self);
-			increment--;
-		}
-		self->macroblock_address++;
+	// Forward
+	if (self->motion_forward.is_set) {
+		int r_size = self->motion_forward.r_size;
+		self->motion_forward.h = plm_video_decode_motion_vector(self, r_size, self->motion_forward.h);
+		self->motion_forward.v = plm_video_decode_motion_vector(self, r_size, self->motion_forward.v);
+	}
+	else if (picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
+		// No motion information in P-picture, reset vectors
+		self->motion_forward.h = 0;
+		self->motion_forward.v = 0;
 	}
 
-	self->mb_row = self->macroblock_address / self->mb_width;
-	self->mb_col = self->macroblock_address % self->mb_width;
+	if (self->motion_backward.is_set) {
+		int r_size = self->motion_backward.r_size;
+		self->motion_backward.h = plm_video_decode_motion_vector(self, r_size, self->motion_backward.h);
+		self->motion_backward.v = plm_video_decode_motion_vector(self, r_size, self->motion_backward.v);
+	}
+}
 
-	if (self->mb_col >= self->mb_width || self->mb_row >= self->mb_height) {
-		return; // corrupt stream;
+// The macroblock decoder for each picture type, from one source. The picture
+// type is a constant, so the checks on it are resolved at compile time; what
+// is left to branch on is the data of each macroblock. PREDICT predicts a
+// non-intra macroblock, SKIP handles a run of skipped ones.
+
+#define PLM_DEFINE_DECODE_MACROBLOCK_FUNCTION(NAME, PICTURE_TYPE, PREDICT, SKIP) \
+	void NAME(plm_video_t *self) { \
+		int increment = plm_video_read_address_increment(self); \
+		\
+		/* Process any skipped macroblocks */ \
+		if (self->slice_begin) { \
+			/* The first increment of each slice is relative to beginning of */ \
+			/* the previous row, not the previous macroblock */ \
+			self->slice_begin = FALSE; \
+			self->macroblock_address += increment; \
+		} \
+		else { \
+			if (self->macroblock_address + increment >= self->slice_end_address) { \
+				return; /* invalid */ \
+			} \
+			if (increment > 1) { \
+				/* Skipped macroblocks reset DC predictors */ \
+				self->dc_predictor[0] = 128; \
+				self->dc_predictor[1] = 128; \
+				self->dc_predictor[2] = 128; \
+				\
+				/* Skipped macroblocks in P-pictures reset motion vectors */ \
+				if (PICTURE_TYPE == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) { \
+					self->motion_forward.h = 0; \
+					self->motion_forward.v = 0; \
+				} \
+				SKIP(self, increment - 1); \
+			} \
+			self->macroblock_address++; \
+		} \
+		\
+		self->mb_row = self->macroblock_address / self->mb_width; \
+		self->mb_col = self->macroblock_address % self->mb_width; \
+		\
+		if ( \
+			self->macroblock_address < 0 || \
+			self->macroblock_address >= self->slice_end_address || \
+			self->mb_col >= self->mb_width || self->mb_row >= self->mb_height \
+		) { \
+			return; /* corrupt stream */ \
+		} \
+		\
+		/* Process the current macroblock */ \
+		const plm_vlc_table_t *table = PLM_VIDEO_MACROBLOCK_TYPE[PICTURE_TYPE]; \
+		self->macroblock_type = plm_buffer_read_vlc(self->buffer, table); \
+		\
+		self->macroblock_intra = (self->macroblock_type & 0x01); \
+		self->motion_forward.is_set = (self->macroblock_type & 0x08); \
+		self->motion_backward.is_set = (self->macroblock_type & 0x04); \
+		\
+		/* Quantizer scale */ \
+		if ((self->macroblock_type & 0x10) != 0) { \
+			plm_video_set_quantizer_scale(self, plm_buffer_read(self->buffer, 5)); \
+		} \
+		\
+		if (self->macroblock_intra) { \
+			/* Intra-coded macroblocks reset motion vectors */ \
+			self->motion_backward.h = self->motion_forward.h = 0; \
+			self->motion_backward.v = self->motion_forward.v = 0; \
+		} \
+		else { \
+			/* Non-intra macroblocks reset DC predictors */ \
+			self->dc_predictor[0] = 128; \
+			self->dc_predictor[1] = 128; \
+			self->dc_predictor[2] = 128; \
+			\
+			if (PICTURE_TYPE != PLM_VIDEO_PICTURE_TYPE_INTRA) { \
+				plm_video_decode_motion_vectors(self, PICTURE_TYPE); \
+			} \
+		} \
+		if (self->batch) { \
+			plm_video_start_macroblock(self, self->macroblock_intra); \
+		} \
+		else if (!self->macroblock_intra) { \
+			PREDICT(self); \
+		} \
+		\
+		/* Decode blocks */ \
+		int cbp = ((self->macroblock_type & 0x02) != 0) \
+			? plm_buffer_read_vlc(self->buffer, &PLM_VIDEO_CODE_BLOCK_PATTERN) \
+			: (self->macroblock_intra ? 0x3f : 0); \
+		\
+		for (int block = 0, mask = 0x20; block < 6; block++) { \
+			if ((cbp & mask) != 0) { \
+				plm_video_decode_block(self, block); \
+			} \
+			mask >>= 1; \
+		} \
 	}
 
-	// Process the current macroblock
-	const plm_vlc_t *table = PLM_VIDEO_MACROBLOCK_TYPE[self->picture_type];
-	self->macroblock_type = plm_buffer_read_vlc(self->buffer, table);
+// Skipped macroblocks in I-pictures aren't allowed, but are treated like in
+// P-pictures, where the motion vectors are 0 by now.
 
-	self->macroblock_intra = (self->macroblock_type & 0x01);
-	self->motion_forward.is_set = (self->macroblock_type & 0x08);
-	self->motion_backward.is_set = (self->macroblock_type & 0x04);
+PLM_DEFINE_DECODE_MACROBLOCK_FUNCTION(plm_video_decode_macroblock_i, PLM_VIDEO_PICTURE_TYPE_INTRA, plm_video_predict_forward, plm_video_skip_forward)
+PLM_DEFINE_DECODE_MACROBLOCK_FUNCTION(plm_video_decode_macroblock_p, PLM_VIDEO_PICTURE_TYPE_PREDICTIVE, plm_video_predict_forward, plm_video_skip_forward)
+PLM_DEFINE_DECODE_MACROBLOCK_FUNCTION(plm_video_decode_macroblock_b, PLM_VIDEO_PICTURE_TYPE_B, plm_video_predict_bidirectional, plm_video_skip_bidirectional)
 
-	// Quantizer scale
-	if ((self->macroblock_type & 0x10) != 0) {
-		self->quantizer_scale = plm_buffer_read(self->buffer, 5);
-	}
+#undef PLM_DEFINE_DECODE_MACROBLOCK_FUNCTION
 
-	if (self->macroblock_intra) {
-		// Intra-coded macroblocks reset motion vectors
-		self->motion_backward.h = self->motion_forward.h = 0;
-		self->motion_backward.v = self->motion_forward.v = 0;
+// Skip count macroblocks after the current one in an I- or P-picture. Without
+// motion they are copies of the forward reference, which is done a row at a
+// time for each run.
+
+void plm_video_skip_forward(plm_video_t *self, int count) {
+	if (self->batch) {
+		for (int i = 0; i < count; i++) {
+			self->macroblock_address++;
+			self->mb_row = self->macroblock_address / self->mb_width;
+			self->mb_col = self->macroblock_address % self->mb_width;
+			plm_video_start_macroblock(self, FALSE);
+		}
+		return;
 	}
-	else {
-		// Non-intra macroblocks reset DC predictors
-		self->dc_predictor[0] = 128;
-		self->dc_predictor[1] = 128;
-		self->dc_predictor[2] = 128;
 
-		plm_video_decode_motion_vectors(self);
-		plm_video_predict_macroblock(self);
+	PLM_PROFILE_BEGIN(profile_start);
+	plm_frame_t *s = &self->frame_forward;
+	plm_frame_t *d = &self->frame_current;
+	int luma_size = 16 >> self->scale_shift;
+	int chroma_size = 8 >> self->scale_shift;
+	while (count > 0) {
+		int address = self->macroblock_address + 1;
+		int mb_row = address / self->mb_width;
+		int mb_col = address % self->mb_width;
+		int run = self->mb_width - mb_col;
+		if (run > count) {
+			run = count;
+		}
+		plm_video_copy_plane_rect(&s->y, &d->y, mb_col * luma_size, mb_row * luma_size, run * luma_size, luma_size);
+		plm_video_copy_plane_rect(&s->cr, &d->cr, mb_col * chroma_size, mb_row * chroma_size, run * chroma_size, chroma_size);
+		plm_video_copy_plane_rect(&s->cb, &d->cb, mb_col * chroma_size, mb_row * chroma_size, run * chroma_size, chroma_size);
+		self->macroblock_address += run;
+		count -= run;
 	}
+	self->mb_row = self->macroblock_address / self->mb_width;
+	self->mb_col = self->macroblock_address % self->mb_width;
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO_MC, profile_start);
+}
 
-	// Decode blocks
-	int cbp = ((self->macroblock_type & 0x02) != 0)
-		? plm_buffer_read_vlc(self->buffer, PLM_VIDEO_CODE_BLOCK_PATTERN)
-		: (self->macroblock_intra ? 0x3f : 0);
+// Skipped macroblocks in B-pictures repeat the prediction of the one before,
+// so they are predicted one by one.
 
-	for (int block = 0, mask = 0x20; block < 6; block++) {
-		if ((cbp & mask) != 0) {
-			plm_video_decode_block(self, block);
+void plm_video_skip_bidirectional(plm_video_t *self, int count) {
+	for (int i = 0; i < count; i++) {
+		self->macroblock_address++;
+		self->mb_row = self->macroblock_address / self->mb_width;
+		self->mb_col = self->macroblock_address % self->mb_width;
+		if (self->batch) {
+			plm_video_start_macroblock(self, FALSE);
+		}
+		else {
+			plm_video_predict_bidirectional(self);
 		}
-		mask >>= 1;
 	}
 }
 
-void plm_video_decode_motion_vectors(plm_video_t *self) {
+void plm_video_copy_plane_rect(plm_plane_t *s, plm_plane_t *d, int x, int y, int width, int height) {
+	uint8_t *source = s->data + y * s->stride + x;
+	uint8_t *dest = d->data + y * d->stride + x;
+	for (int i = 0; i < height; i++) {
+		memcpy(dest, source, width);
+		source += s->stride;
+		dest += d->stride;
+	}
+}
 
-	// Forward
-	if (self->motion_forward.is_set) {
-		int r_size = self->motion_forward.r_size;
-		self->motion_forward.h = plm_video_decode_motion_vector(self, r_size, self->motion_forward.h);
-		self->motion_forward.v = plm_video_decode_motion_vector(self, r_size, self->motion_forward.v);
+// Predict the current macroblock unless it's intra-coded, or with two-pass
+// decoding, add a record for it to the batch.
+
+void plm_video_start_macroblock(plm_video_t *self, int intra) {
+	plm_video_batch_t *batch = self->batch;
+	if (!batch) {
+		if (!intra) {
+			plm_video_predict_macroblock(self);
+		}
+		return;
 	}
-	else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE) {
-		// No motion information in P-picture, reset vectors
-		self->motion_forward.h = 0;
-		self->motion_forward.v = 0;
+
+	if (batch->len == PLM_VIDEO_BATCH_SIZE) {
+		plm_video_reconstruct_batch(self);
 	}
+	plm_video_record_t *record = &batch->records[batch->len++];
+	record->mb_row = self->mb_row;
+	record->mb_col = self->mb_col;
+	record->intra = intra;
+	record->motion_forward = self->motion_forward;
+	record->motion_backward = self->motion_backward;
+	memset(record->n, 0, sizeof(record->n));
+}
 
-	if (self->motion_backward.is_set) {
-		int r_size = self->motion_backward.r_size;
-		self->motion_backward.h = plm_video_decode_motion_vector(self, r_size, self->motion_backward.h);
-		self->motion_backward.v = plm_video_decode_motion_vector(self, r_size, self->motion_backward.v);
+// The second pass of two-pass decoding. It works on the same fields as the
+// parser does, which are put back afterwards, so it can run in the middle of
+// a slice.
+
+void plm_video_reconstruct_batch(plm_video_t *self) {
+	plm_video_batch_t *batch = self->batch;
+	int mb_row = self->mb_row;
+	int mb_col = self->mb_col;
+	int macroblock_intra = self->macroblock_intra;
+	plm_video_motion_t motion_forward = self->motion_forward;
+	plm_video_motion_t motion_backward = self->motion_backward;
+
+	for (int i = 0; i < batch->len; i++) {
+		plm_video_record_t *record = &batch->records[i];
+		self->mb_row = record->mb_row;
+		self->mb_col = record->mb_col;
+		self->macroblock_intra = record->intra;
+		if (!record->intra) {
+			self->motion_forward = record->motion_forward;
+			self->motion_backward = record->motion_backward;
+			plm_video_predict_macroblock(self);
+		}
+		for (int block = 0; block < 6; block++) {
+			if (record->n[block]) {
+				plm_video_reconstruct_block(
+					self, block, batch->coeffs[i][block],
+					record->n[block], record->support[block]
+				);
+			}
+		}
 	}
+	batch->len = 0;
+
+	self->mb_row = mb_row;
+	self->mb_col = mb_col;
+	self->macroblock_intra = macroblock_intra;
+	self->motion_forward = motion_forward;
+	self->motion_backward = motion_backward;
 }
 
 int plm_video_decode_motion_vector(plm_video_t *self, int r_size, int motion) {
 	int fscale = 1 << r_size;
-	int m_code = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MOTION);
+	int m_code = plm_buffer_read_vlc(self->buffer, &PLM_VIDEO_MOTION);
 	int r = 0;
 	int d;
 
@@ -3110,6 +6084,16 @@ int plm_video_decode_motion_vector(plm_video_t *self, int r_size, int motion) {
 }
 
 void plm_video_predict_macroblock(plm_video_t *self) {
+	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
+		plm_video_predict_bidirectional(self);
+	}
+	else {
+		plm_video_predict_forward(self);
+	}
+}
+
+void plm_video_predict_forward(plm_video_t *self) {
+	PLM_PROFILE_BEGIN(profile_start);
 	int fw_h = self->motion_forward.h;
 	int fw_v = self->motion_forward.v;
 
@@ -3118,42 +6102,102 @@ void plm_video_predict_macroblock(plm_video_t *self) {
 		fw_v <<= 1;
 	}
 
-	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
-		int bw_h = self->motion_backward.h;
-		int bw_v = self->motion_backward.v;
+	plm_video_copy_macroblock(self, &self->frame_forward, fw_h, fw_v);
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO_MC, profile_start);
+}
 
-		if (self->motion_backward.full_px) {
-			bw_h <<= 1;
-			bw_v <<= 1;
-		}
+void plm_video_predict_bidirectional(plm_video_t *self) {
+	PLM_PROFILE_BEGIN(profile_start);
+	int fw_h = self->motion_forward.h;
+	int fw_v = self->motion_forward.v;
 
-		if (self->motion_forward.is_set) {
-			plm_video_copy_macroblock(self, &self->frame_forward, fw_h, fw_v);
-			if (self->motion_backward.is_set) {
-				plm_video_interpolate_macroblock(self, &self->frame_backward, bw_h, bw_v);
-			}
-		}
-		else {
-			plm_video_copy_macroblock(self, &self->frame_backward, bw_h, bw_v);
+	if (self->motion_forward.full_px) {
+		fw_h <<= 1;
+		fw_v <<= 1;
+	}
+
+	int bw_h = self->motion_backward.h;
+	int bw_v = self->motion_backward.v;
+
+	if (self->motion_backward.full_px) {
+		bw_h <<= 1;
+		bw_v <<= 1;
+	}
+
+	if (self->motion_forward.is_set) {
+		plm_video_copy_macroblock(self, &self->frame_forward, fw_h, fw_v);
+		if (self->motion_backward.is_set) {
+			plm_video_interpolate_macroblock(self, &self->frame_backward, bw_h, bw_v);
 		}
 	}
 	else {
-		plm_video_copy_macroblock(self, &self->frame_forward, fw_h, fw_v);
+		plm_video_copy_macroblock(self, &self->frame_backward, bw_h, bw_v);
 	}
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO_MC, profile_start);
+}
+
+// Divide a motion vector by 2^shift, rounding towards zero like MPEG-1 does
+// when it derives the chroma vectors. Used for reduced resolution decoding.
+
+static inline int plm_video_scale_motion(int motion, int shift) {
+	return motion < 0 ? -(-motion >> shift) : motion >> shift;
+}
+
+// Whether the blocks a motion vector points to lie within the reference
+// planes and their border, if they have one. MPEG-1 doesn't allow anything
+// else, so if they don't, the stream is corrupt and the macroblock isn't
+// predicted. This is the only bounds check of motion compensation.
+
+int plm_video_motion_in_range(plm_video_t *self, int motion_h, int motion_v) {
+	int shift = self->scale_shift;
+	int border = self->border;
+	int luma_size = 16 >> shift;
+	int chroma_size = 8 >> shift;
+	int luma_h = plm_video_scale_motion(motion_h, shift);
+	int luma_v = plm_video_scale_motion(motion_v, shift);
+	int chroma_h = plm_video_scale_motion(motion_h, shift + 1);
+	int chroma_v = plm_video_scale_motion(motion_v, shift + 1);
+	int x = self->mb_col * luma_size + (luma_h >> 1) + border;
+	int y = self->mb_row * luma_size + (luma_v >> 1) + border;
+	int chroma_x = self->mb_col * chroma_size + (chroma_h >> 1) + border / 2;
+	int chroma_y = self->mb_row * chroma_size + (chroma_v >> 1) + border / 2;
+
+	// Negative positions wrap around and fail too
+	return
+		(unsigned int)x <= (unsigned int)(self->luma_width + 2 * border - luma_size - (luma_h & 1)) &&
+		(unsigned int)y <= (unsigned int)(self->luma_height + 2 * border - luma_size - (luma_v & 1)) &&
+		(unsigned int)chroma_x <= (unsigned int)(self->chroma_width + border - chroma_size - (chroma_h & 1)) &&
+		(unsigned int)chroma_y <= (unsigned int)(self->chroma_height + border - chroma_size - (chroma_v & 1));
 }
 
 void plm_video_copy_macroblock(plm_video_t *self, plm_frame_t *s, int motion_h, int motion_v) {
+	if (!plm_video_motion_in_range(self, motion_h, motion_v)) {
+		return; // corrupt video
+	}
+	int shift = self->scale_shift;
+	int luma_h = plm_video_scale_motion(motion_h, shift);
+	int luma_v = plm_video_scale_motion(motion_v, shift);
+	int chroma_h = plm_video_scale_motion(motion_h, shift + 1);
+	int chroma_v = plm_video_scale_motion(motion_v, shift + 1);
 	plm_frame_t *d = &self->frame_current;
-	plm_video_process_macroblock(self, s->y.data, d->y.data, motion_h, motion_v, 16, FALSE);
-	plm_video_process_macroblock(self, s->cr.data, d->cr.data, motion_h / 2, motion_v / 2, 8, FALSE);
-	plm_video_process_macroblock(self, s->cb.data, d->cb.data, motion_h / 2, motion_v / 2, 8, FALSE);
+	plm_video_process_macroblock(self, s->y.data, d->y.data, d->y.stride, luma_h, luma_v, 16 >> shift, FALSE);
+	plm_video_process_macroblock(self, s->cr.data, d->cr.data, d->cr.stride, chroma_h, chroma_v, 8 >> shift, FALSE);
+	plm_video_process_macroblock(self, s->cb.data, d->cb.data, d->cb.stride, chroma_h, chroma_v, 8 >> shift, FALSE);
 }
 
 void plm_video_interpolate_macroblock(plm_video_t *self, plm_frame_t *s, int motion_h, int motion_v) {
+	if (!plm_video_motion_in_range(self, motion_h, motion_v)) {
+		return; // corrupt video
+	}
+	int shift = self->scale_shift;
+	int luma_h = plm_video_scale_motion(motion_h, shift);
+	int luma_v = plm_video_scale_motion(motion_v, shift);
+	int chroma_h = plm_video_scale_motion(motion_h, shift + 1);
+	int chroma_v = plm_video_scale_motion(motion_v, shift + 1);
 	plm_frame_t *d = &self->frame_current;
-	plm_video_process_macroblock(self, s->y.data, d->y.data, motion_h, motion_v, 16, TRUE);
-	plm_video_process_macroblock(self, s->cr.data, d->cr.data, motion_h / 2, motion_v / 2, 8, TRUE);
-	plm_video_process_macroblock(self, s->cb.data, d->cb.data, motion_h / 2, motion_v / 2, 8, TRUE);
+	plm_video_process_macroblock(self, s->y.data, d->y.data, d->y.stride, luma_h, luma_v, 16 >> shift, TRUE);
+	plm_video_process_macroblock(self, s->cr.data, d->cr.data, d->cr.stride, chroma_h, chroma_v, 8 >> shift, TRUE);
+	plm_video_process_macroblock(self, s->cb.data, d->cb.data, d->cb.stride, chroma_h, chroma_v, 8 >> shift, TRUE);
 }
 
 #define PLM_BLOCK_SET(DEST, DEST_INDEX, DEST_WIDTH, SOURCE_INDEX, SOURCE_WIDTH, BLOCK_SIZE, OP) do { \
@@ -3168,49 +6212,109 @@ void plm_video_interpolate_macroblock(plm_video_t *self, plm_frame_t *s, int mot
 		DEST_INDEX += dest_scan; \
 	}} while(FALSE)
 
+// The 8 motion compensation cases, indexed by (interpolate, odd_h, odd_v). 
+// Each is instantiated for 16x16 luma and 8x8 chroma blocks, and for the 4x4,
+// 2x2 and 1x1 blocks of reduced resolution decoding.
+
+#define PLM_DEFINE_MC_FUNCTION(NAME, BLOCK_SIZE, OP) \
+	void NAME(uint8_t *d, uint8_t *s, int dw) { \
+		int di = 0; \
+		int si = 0; \
+		PLM_BLOCK_SET(d, di, dw, si, dw, BLOCK_SIZE, OP); \
+	}
+
+#define PLM_DEFINE_MC_FUNCTIONS(SUFFIX, BLOCK_SIZE) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_copy_##SUFFIX, BLOCK_SIZE, (s[si])) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_copy_v_##SUFFIX, BLOCK_SIZE, (s[si] + s[si + dw] + 1) >> 1) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_copy_h_##SUFFIX, BLOCK_SIZE, (s[si] + s[si + 1] + 1) >> 1) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_copy_hv_##SUFFIX, BLOCK_SIZE, (s[si] + s[si + 1] + s[si + dw] + s[si + dw + 1] + 2) >> 2) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_avg_##SUFFIX, BLOCK_SIZE, (d[di] + (s[si]) + 1) >> 1) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_avg_v_##SUFFIX, BLOCK_SIZE, (d[di] + ((s[si] + s[si + dw] + 1) >> 1) + 1) >> 1) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_avg_h_##SUFFIX, BLOCK_SIZE, (d[di] + ((s[si] + s[si + 1] + 1) >> 1) + 1) >> 1) \
+	PLM_DEFINE_MC_FUNCTION(plm_video_mc_avg_hv_##SUFFIX, BLOCK_SIZE, (d[di] + ((s[si] + s[si + 1] + s[si + dw] + s[si + dw + 1] + 2) >> 2) + 1) >> 1) \
+	static const plm_video_mc_t PLM_VIDEO_MC_##SUFFIX[] = { \
+		plm_video_mc_copy_##SUFFIX, plm_video_mc_copy_v_##SUFFIX, \
+		plm_video_mc_copy_h_##SUFFIX, plm_video_mc_copy_hv_##SUFFIX, \
+		plm_video_mc_avg_##SUFFIX, plm_video_mc_avg_v_##SUFFIX, \
+		plm_video_mc_avg_h_##SUFFIX, plm_video_mc_avg_hv_##SUFFIX \
+	};
+
+PLM_DEFINE_MC_FUNCTIONS(LUMA, 16)
+PLM_DEFINE_MC_FUNCTIONS(CHROMA, 8)
+PLM_DEFINE_MC_FUNCTIONS(4X4, 4)
+PLM_DEFINE_MC_FUNCTIONS(2X2, 2)
+PLM_DEFINE_MC_FUNCTIONS(1X1, 1)
+
+#undef PLM_DEFINE_MC_FUNCTIONS
+#undef PLM_DEFINE_MC_FUNCTION
+
 void plm_video_process_macroblock(
-	plm_video_t *self, uint8_t *s, uint8_t *d,
+	plm_video_t *self, uint8_t *s, uint8_t *d, int dw,
 	int motion_h, int motion_v, int block_size, int interpolate
 ) {
-	int dw = self->mb_width * block_size;
-
 	int hp = motion_h >> 1;
 	int vp = motion_v >> 1;
 	int odd_h = (motion_h & 1) == 1;
 	int odd_v = (motion_v & 1) == 1;
 
-	unsigned int si = ((self->mb_row * block_size) + vp) * dw + (self->mb_col * block_size) + hp;
-	unsigned int di = (self->mb_row * dw + self->mb_col) * block_size;
-	
-	unsigned int max_address = (dw * (self->mb_height * block_size - block_size + 1) - block_size);
-	if (si > max_address || di > max_address) {
-		return; // corrupt video
-	}
+	int si = ((self->mb_row * block_size) + vp) * dw + (self->mb_col * block_size) + hp;
+	int di = (self->mb_row * dw + self->mb_col) * block_size;
 
-	#define PLM_MB_CASE(INTERPOLATE, ODD_H, ODD_V, OP) \
-		case ((INTERPOLATE << 2) | (ODD_H << 1) | (ODD_V)): \
-			PLM_BLOCK_SET(d, di, dw, si, dw, block_size, OP); \
-			break
+	const plm_video_mc_t *mc = block_size == (8 >> self->scale_shift) ? self->mc_chroma : self->mc_luma;
+	mc[(interpolate << 2) | (odd_h << 1) | (odd_v)](d + di, s + si, dw);
+}
 
-	switch ((interpolate << 2) | (odd_h << 1) | (odd_v)) {
-		PLM_MB_CASE(0, 0, 0, (s[si]));
-		PLM_MB_CASE(0, 0, 1, (s[si] + s[si + dw] + 1) >> 1);
-		PLM_MB_CASE(0, 1, 0, (s[si] + s[si + 1] + 1) >> 1);
-		PLM_MB_CASE(0, 1, 1, (s[si] + s[si + 1] + s[si + dw] + s[si + dw + 1] + 2) >> 2);
+// The dequantization tables hold the quantizer scale times each entry of the
+// quant matrices. They only change with the scale or the matrices, which is
+// rare compared to the coefficients they are applied to.
 
-		PLM_MB_CASE(1, 0, 0, (d[di] + (s[si]) + 1) >> 1);
-		PLM_MB_CASE(1, 0, 1, (d[di] + ((s[si] + s[si + dw] + 1) >> 1) + 1) >> 1);
-		PLM_MB_CASE(1, 1, 0, (d[di] + ((s[si] + s[si + 1] + 1) >> 1) + 1) >> 1);
-		PLM_MB_CASE(1, 1, 1, (d[di] + ((s[si] + s[si + 1] + s[si + dw] + s[si + dw + 1] + 2) >> 2) + 1) >> 1);
+void plm_video_set_quantizer_scale(plm_video_t *self, int quantizer_scale) {
+	if (quantizer_scale != self->quantizer_scale) {
+		self->quantizer_scale = quantizer_scale;
+		plm_video_update_dequant(self);
 	}
+}
 
-	#undef PLM_MB_CASE
+void plm_video_update_dequant(plm_video_t *self) {
+	for (int i = 0; i < 64; i++) {
+		self->intra_dequant[i] = self->quantizer_scale * self->intra_quant_matrix[i];
+		self->non_intra_dequant[i] = self->quantizer_scale * self->non_intra_quant_matrix[i];
+	}
 }
 
+// Decode a block's coefficients and reconstruct it into the current frame or,
+// with two-pass decoding, leave them in the current macroblock's record.
+
 void plm_video_decode_block(plm_video_t *self, int block) {
+	PLM_PROFILE_BEGIN(profile_start);
+	plm_video_batch_t *batch = self->batch;
+	int16_t *coeffs = batch
+		? batch->coeffs[batch->len - 1][block]
+		: self->block_data;
+
+	int support = 0;
+	int n = plm_video_decode_coefficients(self, block, coeffs, &support);
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO_VLC, profile_start);
+	if (!n) {
+		return; // invalid
+	}
+
+	if (batch) {
+		batch->records[batch->len - 1].n[block] = n;
+		batch->records[batch->len - 1].support[block] = support;
+	}
+	else {
+		plm_video_reconstruct_block(self, block, coeffs, n, support);
+	}
+}
 
+// Read the coefficients of a block into coeffs, which must be all zero.
+// Returns the zig-zag index past the last one, or 0 if the block is invalid;
+// *support gets the OR of their positions.
+
+int plm_video_decode_coefficients(plm_video_t *self, int block, int16_t *coeffs, int *support) {
 	int n = 0;
-	uint8_t *quant_matrix;
+	uint16_t *dequant;
 
 	// Decode DC coefficient of intra-coded blocks
 	if (self->macroblock_intra) {
@@ -3223,37 +6327,42 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 		dct_size = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_DCT_SIZE[plane_index]);
 
 		// Read DC coeff
+		int dc = predictor;
 		if (dct_size > 0) {
 			int differential = plm_buffer_read(self->buffer, dct_size);
 			if ((differential & (1 << (dct_size - 1))) != 0) {
-				self->block_data[0] = predictor + differential;
+				dc = predictor + differential;
 			}
 			else {
-				self->block_data[0] = predictor + (-(1 << dct_size) | (differential + 1));
+				dc = predictor + (-(1 << dct_size) | (differential + 1));
 			}
 		}
-		else {
-			self->block_data[0] = predictor;
-		}
 
 		// Save predictor value
-		self->dc_predictor[plane_index] = self->block_data[0];
+		self->dc_predictor[plane_index] = dc;
 
-		// Dequantize + premultiply
-		self->block_data[0] <<= (3 + 5);
+		// Dequantize, clip; only corrupt streams leave the 0--255 range
+		dc <<= 3;
+		if (dc > 2047) {
+			dc = 2047;
+		}
+		else if (dc < -2048) {
+			dc = -2048;
+		}
+		coeffs[0] = dc;
 
-		quant_matrix = self->intra_quant_matrix;
+		dequant = self->intra_dequant;
 		n = 1;
 	}
 	else {
-		quant_matrix = self->non_intra_quant_matrix;
+		dequant = self->non_intra_dequant;
 	}
 
 	// Decode AC coefficients (+DC for non-intra)
 	int level = 0;
 	while (TRUE) {
 		int run = 0;
-		uint16_t coeff = plm_buffer_read_vlc_uint(self->buffer, PLM_VIDEO_DCT_COEFF);
+		uint16_t coeff = plm_buffer_read_vlc_uint(self->buffer, &PLM_VIDEO_DCT_COEFF);
 
 		if ((coeff == 0x0001) && (n > 0) && (plm_buffer_read(self->buffer, 1) == 0)) {
 			// end_of_block
@@ -3283,10 +6392,12 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 
 		n += run;
 		if (n < 0 || n >= 64) {
-			return; // invalid
+			memset(coeffs, 0, 64 * sizeof(int16_t));
+			return 0;
 		}
 
 		int de_zig_zagged = PLM_VIDEO_ZIG_ZAG[n];
+		*support |= de_zig_zagged;
 		n++;
 
 		// Dequantize, oddify, clip
@@ -3294,7 +6405,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 		if (!self->macroblock_intra) {
 			level += (level < 0 ? -1 : 1);
 		}
-		level = (level * self->quantizer_scale * quant_matrix[de_zig_zagged]) >> 4;
+		level = (level * dequant[de_zig_zagged]) >> 4;
 		if ((level & 1) == 0) {
 			level -= level > 0 ? 1 : -1;
 		}
@@ -3305,125 +6416,734 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 			level = -2048;
 		}
 
-		// Save premultiplied coefficient
-		self->block_data[de_zig_zagged] = level * PLM_VIDEO_PREMULTIPLIER_MATRIX[de_zig_zagged];
+		// Save coefficient; the IDCT premultiplies it when loading
+		coeffs[de_zig_zagged] = level;
+	}
+	return n;
+}
+
+// Transform a block of coefficients and put or add it at its place in the
+// current macroblock. The coefficients are all zero again afterwards.
+
+void plm_video_reconstruct_block(plm_video_t *self, int block, int16_t *coeffs, int n, int support) {
+	PLM_PROFILE_BEGIN(profile_start);
+
+	// Move block to its place
+	uint8_t *d;
+	int dw;
+	int di;
+
+	int shift = self->scale_shift;
+
+	if (block < 4) {
+		d = self->frame_current.y.data;
+		dw = self->frame_current.y.stride;
+		di = (self->mb_row * dw + self->mb_col) << (4 - shift);
+		if ((block & 1) != 0) {
+			di += 8 >> shift;
+		}
+		if ((block & 2) != 0) {
+			di += dw << (3 - shift);
+		}
+	}
+	else {
+		plm_plane_t *plane = (block == 4) ? &self->frame_current.cb : &self->frame_current.cr;
+		d = plane->data;
+		dw = plane->stride;
+		di = (self->mb_row * dw + self->mb_col) << (3 - shift);
+	}
+
+	if (shift == 3) {
+		// Only the DC coefficient is left, as a single pixel
+		int value = (coeffs[0] + 4) >> 3;
+		d[di] = plm_clamp(self->macroblock_intra ? value : d[di] + value);
+		memset(coeffs, 0, 64 * sizeof(int16_t));
+		PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO_IDCT, profile_start);
+		return;
+	}
+	if (shift) {
+		plm_video_idct_scaled(coeffs, d + di, dw, 8 >> shift, !self->macroblock_intra);
+		PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO_IDCT, profile_start);
+		return;
+	}
+
+	// The OR of all coefficient positions tells which part of the block they
+	// span: bits 3-5 are set by any row but the first, bits 2 and 5 by any
+	// coefficient outside the top-left 4x4 quadrant. A block with only its
+	// first row set has identical rows after the column pass, so one row
+	// transform is enough; a source width of 0 repeats it 8 times below.
+
+	int16_t *s = coeffs;
+	int row[8];
+	int si = 0;
+	if ((support & 0x38) == 0) {
+		for (int i = 0; i < 8; i++) {
+			row[i] = s[i] * PLM_VIDEO_PREMULTIPLIER_MATRIX[i];
+		}
+	}
+	if (self->macroblock_intra) {
+		// Overwrite (no prediction)
+		if (n == 1) {
+			int clamped = plm_clamp((row[0] + 128) >> 8);
+			PLM_BLOCK_SET(d, di, dw, si, 8, 8, clamped);
+			s[0] = 0;
+		}
+		else if ((support & 0x38) == 0) {
+			plm_video_idct_row(row);
+			PLM_BLOCK_SET(d, di, dw, si, 0, 8, plm_clamp(row[si]));
+			memset(s, 0, 8 * sizeof(int16_t));
+		}
+		else if ((support & 0x24) == 0) {
+			self->idct_put_4x4(s, d + di, dw);
+		}
+		else {
+			self->idct_put(s, d + di, dw);
+		}
+	}
+	else {
+		// Add data to the predicted macroblock
+		if (n == 1) {
+			int value = (row[0] + 128) >> 8;
+			PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + value));
+			s[0] = 0;
+		}
+		else if ((support & 0x38) == 0) {
+			plm_video_idct_row(row);
+			PLM_BLOCK_SET(d, di, dw, si, 0, 8, plm_clamp(d[di] + row[si]));
+			memset(s, 0, 8 * sizeof(int16_t));
+		}
+		else if ((support & 0x24) == 0) {
+			self->idct_add_4x4(s, d + di, dw);
+		}
+		else {
+			self->idct_add(s, d + di, dw);
+		}
+	}
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_VIDEO_IDCT, profile_start);
+}
+
+void plm_video_idct(int *block) {
+	int
+		b1, b3, b4, b6, b7, tmp1, tmp2, m0,
+		x0, x1, x2, x3, x4, y3, y4, y5, y6, y7;
+
+	// Transform columns
+	for (int i = 0; i < 8; ++i) {
+		b1 = block[4 * 8 + i];
+		b3 = block[2 * 8 + i] + block[6 * 8 + i];
+		b4 = block[5 * 8 + i] - block[3 * 8 + i];
+		tmp1 = block[1 * 8 + i] + block[7 * 8 + i];
+		tmp2 = block[3 * 8 + i] + block[5 * 8 + i];
+		b6 = block[1 * 8 + i] - block[7 * 8 + i];
+		b7 = tmp1 + tmp2;
+		m0 = block[0 * 8 + i];
+		x4 = ((b6 * 473 - b4 * 196 + 128) >> 8) - b7;
+		x0 = x4 - (((tmp1 - tmp2) * 362 + 128) >> 8);
+		x1 = m0 - b1;
+		x2 = (((block[2 * 8 + i] - block[6 * 8 + i]) * 362 + 128) >> 8) - b3;
+		x3 = m0 + b1;
+		y3 = x1 + x2;
+		y4 = x3 + b3;
+		y5 = x1 - x2;
+		y6 = x3 - b3;
+		y7 = -x0 - ((b4 * 473 + b6 * 196 + 128) >> 8);
+		block[0 * 8 + i] = b7 + y4;
+		block[1 * 8 + i] = x4 + y3;
+		block[2 * 8 + i] = y5 - x0;
+		block[3 * 8 + i] = y6 - y7;
+		block[4 * 8 + i] = y6 + y7;
+		block[5 * 8 + i] = x0 + y5;
+		block[6 * 8 + i] = y3 - x4;
+		block[7 * 8 + i] = y4 - b7;
+	}
+
+	// Transform rows
+	for (int i = 0; i < 64; i += 8) {
+		plm_video_idct_row(block + i);
+	}
+}
+
+void plm_video_idct_row(int *row) {
+	int
+		b1, b3, b4, b6, b7, tmp1, tmp2, m0,
+		x0, x1, x2, x3, x4, y3, y4, y5, y6, y7;
+
+	b1 = row[4];
+	b3 = row[2] + row[6];
+	b4 = row[5] - row[3];
+	tmp1 = row[1] + row[7];
+	tmp2 = row[3] + row[5];
+	b6 = row[1] - row[7];
+	b7 = tmp1 + tmp2;
+	m0 = row[0];
+	x4 = ((b6 * 473 - b4 * 196 + 128) >> 8) - b7;
+	x0 = x4 - (((tmp1 - tmp2) * 362 + 128) >> 8);
+	x1 = m0 - b1;
+	x2 = (((row[2] - row[6]) * 362 + 128) >> 8) - b3;
+	x3 = m0 + b1;
+	y3 = x1 + x2;
+	y4 = x3 + b3;
+	y5 = x1 - x2;
+	y6 = x3 - b3;
+	y7 = -x0 - ((b4 * 473 + b6 * 196 + 128) >> 8);
+	row[0] = (b7 + y4 + 128) >> 8;
+	row[1] = (x4 + y3 + 128) >> 8;
+	row[2] = (y5 - x0 + 128) >> 8;
+	row[3] = (y6 - y7 + 128) >> 8;
+	row[4] = (y6 + y7 + 128) >> 8;
+	row[5] = (x0 + y5 + 128) >> 8;
+	row[6] = (y3 - x4 + 128) >> 8;
+	row[7] = (y4 - b7 + 128) >> 8;
+}
+
+// IDCT followed by the store into the destination plane; either overwriting it
+// (intra blocks) or adding to the prediction (non-intra blocks). Both take the
+// 16 bit dequantized coefficients, premultiply them into 32 bit for the
+// transform, clamp the result to 0--255 and leave the block zeroed for the
+// next call.
+
+void plm_video_idct_put(int16_t *block, uint8_t *dest, int dest_width) {
+	int s[64];
+	for (int i = 0; i < 64; i++) {
+		s[i] = block[i] * PLM_VIDEO_PREMULTIPLIER_MATRIX[i];
+	}
+	plm_video_idct(s);
+	int di = 0;
+	int si = 0;
+	PLM_BLOCK_SET(dest, di, dest_width, si, 8, 8, plm_clamp(s[si]));
+	memset(block, 0, 64 * sizeof(int16_t));
+}
+
+void plm_video_idct_add(int16_t *block, uint8_t *dest, int dest_width) {
+	int s[64];
+	for (int i = 0; i < 64; i++) {
+		s[i] = block[i] * PLM_VIDEO_PREMULTIPLIER_MATRIX[i];
+	}
+	plm_video_idct(s);
+	int di = 0;
+	int si = 0;
+	PLM_BLOCK_SET(dest, di, dest_width, si, 8, 8, plm_clamp(dest[di] + s[si]));
+	memset(block, 0, 64 * sizeof(int16_t));
+}
+
+// A size x size IDCT of the low frequency coefficients of a block, for reduced
+// resolution decoding. Scaling the orthonormal 8 point DCT down to 4 or 2
+// points works out to the same 1/4 normalization as the full 2D IDCT, with the
+// basis functions of the smaller one; these are 2^12 times C(u) * cos((2x+1) *
+// u * pi / (2 * size)), indexed by [x][u].
+
+static const int16_t PLM_VIDEO_IDCT_4[] = {
+	2896,  3784,  2896,  1567,
+	2896,  1567, -2896, -3784,
+	2896, -1567, -2896,  3784,
+	2896, -3784,  2896, -1567
+};
+
+static const int16_t PLM_VIDEO_IDCT_2[] = {
+	2896,  2896,
+	2896, -2896
+};
+
+void plm_video_idct_scaled(int16_t *block, uint8_t *dest, int dest_width, int size, int add) {
+	const int16_t *basis = size == 4 ? PLM_VIDEO_IDCT_4 : PLM_VIDEO_IDCT_2;
+	int tmp[16];
+
+	// Rows; the result keeps the scale of the coefficients
+	for (int v = 0; v < size; v++) {
+		for (int x = 0; x < size; x++) {
+			int sum = 0;
+			for (int u = 0; u < size; u++) {
+				sum += block[v * 8 + u] * basis[x * size + u];
+			}
+			tmp[v * size + x] = (sum + 2048) >> 12;
+		}
+	}
+
+	// Columns, including the 1/4
+	for (int y = 0; y < size; y++) {
+		uint8_t *d = dest + y * dest_width;
+		for (int x = 0; x < size; x++) {
+			int sum = 0;
+			for (int v = 0; v < size; v++) {
+				sum += tmp[v * size + x] * basis[y * size + v];
+			}
+			int value = (sum + 8192) >> 14;
+			d[x] = plm_clamp(add ? d[x] + value : value);
+		}
+	}
+	memset(block, 0, 64 * sizeof(int16_t));
+}
+
+#ifdef PLM_SIMD_X86
+
+// One pass of the IDCT butterfly in plm_video_idct(), over 8 vectors V[0..7]
+// that each hold the same coefficient of several rows or columns. y7 is folded
+// into t = -y7 to avoid a negation; the wrapping integer math is the same.
+
+#define PLM_IDCT_1D(T, V, ADD, SUB, MUL, RSH) do { \
+	T b1 = V[4]; \
+	T b3 = ADD(V[2], V[6]); \
+	T b4 = SUB(V[5], V[3]); \
+	T tmp1 = ADD(V[1], V[7]); \
+	T tmp2 = ADD(V[3], V[5]); \
+	T b6 = SUB(V[1], V[7]); \
+	T b7 = ADD(tmp1, tmp2); \
+	T m0 = V[0]; \
+	T x4 = SUB(RSH(SUB(MUL(b6, 473), MUL(b4, 196))), b7); \
+	T x0 = SUB(x4, RSH(MUL(SUB(tmp1, tmp2), 362))); \
+	T x1 = SUB(m0, b1); \
+	T x2 = SUB(RSH(MUL(SUB(V[2], V[6]), 362)), b3); \
+	T x3 = ADD(m0, b1); \
+	T y3 = ADD(x1, x2); \
+	T y4 = ADD(x3, b3); \
+	T y5 = SUB(x1, x2); \
+	T y6 = SUB(x3, b3); \
+	T t = ADD(x0, RSH(ADD(MUL(b4, 473), MUL(b6, 196)))); \
+	V[0] = ADD(b7, y4); \
+	V[1] = ADD(x4, y3); \
+	V[2] = SUB(y5, x0); \
+	V[3] = ADD(y6, t); \
+	V[4] = SUB(y6, t); \
+	V[5] = ADD(x0, y5); \
+	V[6] = SUB(y3, x4); \
+	V[7] = SUB(y4, b7); \
+} while(FALSE)
+
+// The same with V[4..7] known to be zero; only V[0..3] are read. Folding the
+// zeros in by hand keeps the results bit exact.
+
+#define PLM_IDCT_1D_4(T, V, ADD, SUB, MUL, RSH) do { \
+	T b7 = ADD(V[1], V[3]); \
+	T m0 = V[0]; \
+	T x4 = SUB(RSH(ADD(MUL(V[1], 473), MUL(V[3], 196))), b7); \
+	T x0 = SUB(x4, RSH(MUL(SUB(V[1], V[3]), 362))); \
+	T x2 = SUB(RSH(MUL(V[2], 362)), V[2]); \
+	T y3 = ADD(m0, x2); \
+	T y4 = ADD(m0, V[2]); \
+	T y5 = SUB(m0, x2); \
+	T y6 = SUB(m0, V[2]); \
+	T t = ADD(x0, RSH(SUB(MUL(V[1], 196), MUL(V[3], 473)))); \
+	V[0] = ADD(b7, y4); \
+	V[1] = ADD(x4, y3); \
+	V[2] = SUB(y5, x0); \
+	V[3] = ADD(y6, t); \
+	V[4] = SUB(y6, t); \
+	V[5] = ADD(x0, y5); \
+	V[6] = SUB(y3, x4); \
+	V[7] = SUB(y4, b7); \
+} while(FALSE)
+
+// SSE2 has no 32 bit mullo; multiply even and odd lanes separately.
+
+static inline PLM_TARGET_SSE2 __m128i plm_sse2_mul_const(__m128i a, int c) {
+	__m128i k = _mm_set1_epi32(c);
+	__m128i even = _mm_mul_epu32(a, k);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), k);
+	return _mm_or_si128(
+		_mm_and_si128(even, _mm_set_epi32(0, -1, 0, -1)),
+		_mm_slli_epi64(odd, 32)
+	);
+}
+
+static inline PLM_TARGET_SSE2 __m128i plm_sse2_round(__m128i a) {
+	return _mm_srai_epi32(_mm_add_epi32(a, _mm_set1_epi32(128)), 8);
+}
+
+static inline PLM_TARGET_SSE2 void plm_sse2_transpose4(__m128i *d, const __m128i *s) {
+	__m128i t0 = _mm_unpacklo_epi32(s[0], s[1]);
+	__m128i t1 = _mm_unpacklo_epi32(s[2], s[3]);
+	__m128i t2 = _mm_unpackhi_epi32(s[0], s[1]);
+	__m128i t3 = _mm_unpackhi_epi32(s[2], s[3]);
+	d[0] = _mm_unpacklo_epi64(t0, t1);
+	d[1] = _mm_unpackhi_epi64(t0, t1);
+	d[2] = _mm_unpacklo_epi64(t2, t3);
+	d[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Load row i of the coefficients and premultiply it; 16x16 bit products are
+// put together from their low and high halves.
+
+static inline PLM_TARGET_SSE2 void plm_sse2_load_row(int16_t *block, int i, __m128i *l, __m128i *r) {
+	__m128i c = _mm_loadu_si128((__m128i *)(block + i * 8));
+	__m128i m = _mm_loadu_si128((__m128i *)(PLM_VIDEO_PREMULTIPLIER_MATRIX + i * 8));
+	__m128i lo = _mm_mullo_epi16(c, m);
+	__m128i hi = _mm_mulhi_epi16(c, m);
+	*l = _mm_unpacklo_epi16(lo, hi);
+	*r = _mm_unpackhi_epi16(lo, hi);
+}
+
+// Transpose the row pass results back, round and narrow to 16 bit.
+
+static inline PLM_TARGET_SSE2 void plm_sse2_pack_rows(__m128i *rows, const __m128i *top, const __m128i *bottom) {
+	__m128i l[8], r[8];
+	plm_sse2_transpose4(l, top);
+	plm_sse2_transpose4(r, top + 4);
+	plm_sse2_transpose4(l + 4, bottom);
+	plm_sse2_transpose4(r + 4, bottom + 4);
+	for (int i = 0; i < 8; i++) {
+		rows[i] = _mm_packs_epi32(plm_sse2_round(l[i]), plm_sse2_round(r[i]));
+	}
+}
+
+// Run the full 2D IDCT; on return rows[r] holds the 8 results of row r as
+// 16 bit values.
+
+static inline PLM_TARGET_SSE2 void plm_sse2_idct(int16_t *block, __m128i *rows) {
+	__m128i l[8], r[8], top[8], bottom[8];
+	__m128i zero = _mm_setzero_si128();
+
+	for (int i = 0; i < 8; i++) {
+		plm_sse2_load_row(block, i, &l[i], &r[i]);
+		_mm_storeu_si128((__m128i *)(block + i * 8), zero);
+	}
+
+	// Columns; each lane is one column
+	PLM_IDCT_1D(__m128i, l, _mm_add_epi32, _mm_sub_epi32, plm_sse2_mul_const, plm_sse2_round);
+	PLM_IDCT_1D(__m128i, r, _mm_add_epi32, _mm_sub_epi32, plm_sse2_mul_const, plm_sse2_round);
+
+	// Rows; transpose so that each lane is one row
+	plm_sse2_transpose4(top, l);
+	plm_sse2_transpose4(top + 4, r);
+	plm_sse2_transpose4(bottom, l + 4);
+	plm_sse2_transpose4(bottom + 4, r + 4);
+	PLM_IDCT_1D(__m128i, top, _mm_add_epi32, _mm_sub_epi32, plm_sse2_mul_const, plm_sse2_round);
+	PLM_IDCT_1D(__m128i, bottom, _mm_add_epi32, _mm_sub_epi32, plm_sse2_mul_const, plm_sse2_round);
+
+	plm_sse2_pack_rows(rows, top, bottom);
+}
+
+// The same for blocks with all coefficients in the top-left 4x4 quadrant.
+// Columns 4..7 transform to zero, so the right half is dropped and the row
+// pass only sees 4 inputs. Only the quadrant is cleared.
+
+static inline PLM_TARGET_SSE2 void plm_sse2_idct_4x4(int16_t *block, __m128i *rows) {
+	__m128i l[8], r, top[8], bottom[8];
+	__m128i zero = _mm_setzero_si128();
+
+	for (int i = 0; i < 4; i++) {
+		plm_sse2_load_row(block, i, &l[i], &r);
+		_mm_storel_epi64((__m128i *)(block + i * 8), zero);
+	}
+
+	PLM_IDCT_1D_4(__m128i, l, _mm_add_epi32, _mm_sub_epi32, plm_sse2_mul_const, plm_sse2_round);
+
+	plm_sse2_transpose4(top, l);
+	plm_sse2_transpose4(bottom, l + 4);
+	PLM_IDCT_1D_4(__m128i, top, _mm_add_epi32, _mm_sub_epi32, plm_sse2_mul_const, plm_sse2_round);
+	PLM_IDCT_1D_4(__m128i, bottom, _mm_add_epi32, _mm_sub_epi32, plm_sse2_mul_const, plm_sse2_round);
+
+	plm_sse2_pack_rows(rows, top, bottom);
+}
+
+static inline PLM_TARGET_SSE2 void plm_sse2_put(__m128i *rows, uint8_t *dest, int dest_width) {
+	for (int i = 0; i < 8; i++) {
+		_mm_storel_epi64((__m128i *)(dest + i * dest_width), _mm_packus_epi16(rows[i], rows[i]));
+	}
+}
+
+static inline PLM_TARGET_SSE2 void plm_sse2_add(__m128i *rows, uint8_t *dest, int dest_width) {
+	__m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < 8; i++) {
+		uint8_t *d = dest + i * dest_width;
+		__m128i pred = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)d), zero);
+		__m128i sum = _mm_adds_epi16(pred, rows[i]);
+		_mm_storel_epi64((__m128i *)d, _mm_packus_epi16(sum, sum));
+	}
+}
+
+PLM_TARGET_SSE2 void plm_video_idct_put_sse2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m128i rows[8];
+	plm_sse2_idct(block, rows);
+	plm_sse2_put(rows, dest, dest_width);
+}
+
+PLM_TARGET_SSE2 void plm_video_idct_add_sse2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m128i rows[8];
+	plm_sse2_idct(block, rows);
+	plm_sse2_add(rows, dest, dest_width);
+}
+
+PLM_TARGET_SSE2 void plm_video_idct_put_4x4_sse2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m128i rows[8];
+	plm_sse2_idct_4x4(block, rows);
+	plm_sse2_put(rows, dest, dest_width);
+}
+
+PLM_TARGET_SSE2 void plm_video_idct_add_4x4_sse2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m128i rows[8];
+	plm_sse2_idct_4x4(block, rows);
+	plm_sse2_add(rows, dest, dest_width);
+}
+
+static inline PLM_TARGET_AVX2 __m256i plm_avx2_mul_const(__m256i a, int c) {
+	return _mm256_mullo_epi32(a, _mm256_set1_epi32(c));
+}
+
+// Load row i of the coefficients and premultiply it. Both are sign extended
+// and the multipliers are positive, so the high halves add nothing to madd.
+
+static inline PLM_TARGET_AVX2 __m256i plm_avx2_load_row(int16_t *block, int i) {
+	__m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *)(block + i * 8)));
+	__m256i m = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *)(PLM_VIDEO_PREMULTIPLIER_MATRIX + i * 8)));
+	return _mm256_madd_epi16(c, m);
+}
+
+static inline PLM_TARGET_AVX2 __m256i plm_avx2_round(__m256i a) {
+	return _mm256_srai_epi32(_mm256_add_epi32(a, _mm256_set1_epi32(128)), 8);
+}
+
+static inline PLM_TARGET_AVX2 void plm_avx2_transpose8(__m256i *v) {
+	__m256i t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+	__m256i t1 = _mm256_unpackhi_epi32(v[0], v[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(v[2], v[3]);
+	__m256i t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+	__m256i t4 = _mm256_unpacklo_epi32(v[4], v[5]);
+	__m256i t5 = _mm256_unpackhi_epi32(v[4], v[5]);
+	__m256i t6 = _mm256_unpacklo_epi32(v[6], v[7]);
+	__m256i t7 = _mm256_unpackhi_epi32(v[6], v[7]);
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+	v[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	v[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	v[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	v[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	v[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	v[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	v[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	v[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// Round the row pass results and narrow them to 16 bit, two rows at a time.
+
+static inline PLM_TARGET_AVX2 void plm_avx2_pack_pairs(__m256i *pairs, const __m256i *v) {
+	for (int i = 0; i < 4; i++) {
+		__m256i packed = _mm256_packs_epi32(plm_avx2_round(v[i * 2]), plm_avx2_round(v[i * 2 + 1]));
+		pairs[i] = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+	}
+}
+
+// Run the full 2D IDCT; on return pairs[i] holds rows 2i and 2i+1 as 16 bit
+// values.
+
+static inline PLM_TARGET_AVX2 void plm_avx2_idct(int16_t *block, __m256i *pairs) {
+	__m256i v[8];
+	__m256i zero = _mm256_setzero_si256();
+
+	for (int i = 0; i < 8; i++) {
+		v[i] = plm_avx2_load_row(block, i);
+	}
+	for (int i = 0; i < 64; i += 16) {
+		_mm256_storeu_si256((__m256i *)(block + i), zero);
+	}
+
+	PLM_IDCT_1D(__m256i, v, _mm256_add_epi32, _mm256_sub_epi32, plm_avx2_mul_const, plm_avx2_round);
+	plm_avx2_transpose8(v);
+	PLM_IDCT_1D(__m256i, v, _mm256_add_epi32, _mm256_sub_epi32, plm_avx2_mul_const, plm_avx2_round);
+	plm_avx2_transpose8(v);
+
+	plm_avx2_pack_pairs(pairs, v);
+}
+
+// The same for blocks with all coefficients in the top-left 4x4 quadrant;
+// rows 4..7 are never loaded and both passes only see 4 inputs.
+
+static inline PLM_TARGET_AVX2 void plm_avx2_idct_4x4(int16_t *block, __m256i *pairs) {
+	__m256i v[8];
+	__m128i zero = _mm_setzero_si128();
+
+	for (int i = 0; i < 4; i++) {
+		v[i] = plm_avx2_load_row(block, i);
+		_mm_storeu_si128((__m128i *)(block + i * 8), zero);
 	}
 
-	// Move block to its place
-	uint8_t *d;
-	int dw;
-	int di;
+	PLM_IDCT_1D_4(__m256i, v, _mm256_add_epi32, _mm256_sub_epi32, plm_avx2_mul_const, plm_avx2_round);
+	plm_avx2_transpose8(v);
+	PLM_IDCT_1D_4(__m256i, v, _mm256_add_epi32, _mm256_sub_epi32, plm_avx2_mul_const, plm_avx2_round);
+	plm_avx2_transpose8(v);
 
-	if (block < 4) {
-		d = self->frame_current.y.data;
-		dw = self->luma_width;
-		di = (self->mb_row * self->luma_width + self->mb_col) << 4;
-		if ((block & 1) != 0) {
-			di += 8;
-		}
-		if ((block & 2) != 0) {
-			di += self->luma_width << 3;
-		}
+	plm_avx2_pack_pairs(pairs, v);
+}
+
+static inline PLM_TARGET_AVX2 void plm_avx2_put(__m256i *pairs, uint8_t *dest, int dest_width) {
+	for (int i = 0; i < 4; i++) {
+		__m256i pixels = _mm256_packus_epi16(pairs[i], pairs[i]);
+		uint8_t *d = dest + i * 2 * dest_width;
+		_mm_storel_epi64((__m128i *)d, _mm256_castsi256_si128(pixels));
+		_mm_storel_epi64((__m128i *)(d + dest_width), _mm256_extracti128_si256(pixels, 1));
 	}
-	else {
-		d = (block == 4) ? self->frame_current.cb.data : self->frame_current.cr.data;
-		dw = self->chroma_width;
-		di = ((self->mb_row * self->luma_width) << 2) + (self->mb_col << 3);
+}
+
+static inline PLM_TARGET_AVX2 void plm_avx2_add(__m256i *pairs, uint8_t *dest, int dest_width) {
+	for (int i = 0; i < 4; i++) {
+		uint8_t *d = dest + i * 2 * dest_width;
+		__m128i pred8 = _mm_unpacklo_epi64(
+			_mm_loadl_epi64((__m128i *)d),
+			_mm_loadl_epi64((__m128i *)(d + dest_width))
+		);
+		__m256i sum = _mm256_adds_epi16(_mm256_cvtepu8_epi16(pred8), pairs[i]);
+		__m256i pixels = _mm256_packus_epi16(sum, sum);
+		_mm_storel_epi64((__m128i *)d, _mm256_castsi256_si128(pixels));
+		_mm_storel_epi64((__m128i *)(d + dest_width), _mm256_extracti128_si256(pixels, 1));
 	}
+}
 
-	int *s = self->block_data;
-	int si = 0;
-	if (self->macroblock_intra) {
-		// Overwrite (no prediction)
-		if (n == 1) {
-			int clamped = plm_clamp((s[0] + 128) >> 8);
-			PLM_BLOCK_SET(d, di, dw, si, 8, 8, clamped);
-			s[0] = 0;
-		}
-		else {
-			plm_video_idct(s);
-			PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(s[si]));
-			memset(self->block_data, 0, sizeof(self->block_data));
-		}
+PLM_TARGET_AVX2 void plm_video_idct_put_avx2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m256i pairs[4];
+	plm_avx2_idct(block, pairs);
+	plm_avx2_put(pairs, dest, dest_width);
+}
+
+PLM_TARGET_AVX2 void plm_video_idct_add_avx2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m256i pairs[4];
+	plm_avx2_idct(block, pairs);
+	plm_avx2_add(pairs, dest, dest_width);
+}
+
+PLM_TARGET_AVX2 void plm_video_idct_put_4x4_avx2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m256i pairs[4];
+	plm_avx2_idct_4x4(block, pairs);
+	plm_avx2_put(pairs, dest, dest_width);
+}
+
+PLM_TARGET_AVX2 void plm_video_idct_add_4x4_avx2(int16_t *block, uint8_t *dest, int dest_width) {
+	__m256i pairs[4];
+	plm_avx2_idct_4x4(block, pairs);
+	plm_avx2_add(pairs, dest, dest_width);
+}
+
+#undef PLM_IDCT_1D_4
+#undef PLM_IDCT_1D
+
+// Motion compensation. Each iteration handles 16 pixels; that is one row of a
+// luma block or two rows of a chroma block. (a+b+c+d+2)>>2 can't be composed
+// from pavgb without rounding errors, so it is widened to 16 bit.
+
+static inline PLM_TARGET_SSE2 __m128i plm_sse2_load_luma(uint8_t *p, int dw) {
+	PLM_UNUSED(dw);
+	return _mm_loadu_si128((__m128i *)p);
+}
+
+static inline PLM_TARGET_SSE2 void plm_sse2_store_luma(uint8_t *p, int dw, __m128i v) {
+	PLM_UNUSED(dw);
+	_mm_storeu_si128((__m128i *)p, v);
+}
+
+static inline PLM_TARGET_SSE2 __m128i plm_sse2_load_chroma(uint8_t *p, int dw) {
+	return _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i *)p), _mm_loadl_epi64((__m128i *)(p + dw)));
+}
+
+static inline PLM_TARGET_SSE2 void plm_sse2_store_chroma(uint8_t *p, int dw, __m128i v) {
+	_mm_storel_epi64((__m128i *)p, v);
+	_mm_storel_epi64((__m128i *)(p + dw), _mm_srli_si128(v, 8));
+}
+
+static inline PLM_TARGET_SSE2 __m128i plm_sse2_avg4(__m128i a, __m128i b, __m128i c, __m128i d) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i two = _mm_set1_epi16(2);
+	__m128i lo = _mm_add_epi16(
+		_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+		_mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero))
+	);
+	__m128i hi = _mm_add_epi16(
+		_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+		_mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero))
+	);
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+	return _mm_packus_epi16(lo, hi);
+}
+
+#define PLM_DEFINE_MC_SSE2_FUNCTION(NAME, BLOCK_SIZE, LOAD, STORE, OP) \
+	PLM_TARGET_SSE2 void NAME(uint8_t *d, uint8_t *s, int dw) { \
+		int rows = 16 / BLOCK_SIZE; \
+		for (int y = 0; y < BLOCK_SIZE; y += rows) { \
+			STORE(d, dw, OP); \
+			s += dw * rows; \
+			d += dw * rows; \
+		} \
 	}
-	else {
-		// Add data to the predicted macroblock
-		if (n == 1) {
-			int value = (s[0] + 128) >> 8;
-			PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + value));
-			s[0] = 0;
+
+#define PLM_DEFINE_MC_SSE2_FUNCTIONS(SUFFIX, BLOCK_SIZE, L, S) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_copy_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		L(s, dw)) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_copy_v_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		_mm_avg_epu8(L(s, dw), L(s + dw, dw))) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_copy_h_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		_mm_avg_epu8(L(s, dw), L(s + 1, dw))) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_copy_hv_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		plm_sse2_avg4(L(s, dw), L(s + 1, dw), L(s + dw, dw), L(s + dw + 1, dw))) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_avg_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		_mm_avg_epu8(L(d, dw), L(s, dw))) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_avg_v_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		_mm_avg_epu8(L(d, dw), _mm_avg_epu8(L(s, dw), L(s + dw, dw)))) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_avg_h_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		_mm_avg_epu8(L(d, dw), _mm_avg_epu8(L(s, dw), L(s + 1, dw)))) \
+	PLM_DEFINE_MC_SSE2_FUNCTION(plm_video_mc_avg_hv_##SUFFIX##_sse2, BLOCK_SIZE, L, S, \
+		_mm_avg_epu8(L(d, dw), plm_sse2_avg4(L(s, dw), L(s + 1, dw), L(s + dw, dw), L(s + dw + 1, dw)))) \
+	static const plm_video_mc_t PLM_VIDEO_MC_##SUFFIX##_SSE2[] = { \
+		plm_video_mc_copy_##SUFFIX##_sse2, plm_video_mc_copy_v_##SUFFIX##_sse2, \
+		plm_video_mc_copy_h_##SUFFIX##_sse2, plm_video_mc_copy_hv_##SUFFIX##_sse2, \
+		plm_video_mc_avg_##SUFFIX##_sse2, plm_video_mc_avg_v_##SUFFIX##_sse2, \
+		plm_video_mc_avg_h_##SUFFIX##_sse2, plm_video_mc_avg_hv_##SUFFIX##_sse2 \
+	};
+
+PLM_DEFINE_MC_SSE2_FUNCTIONS(LUMA, 16, plm_sse2_load_luma, plm_sse2_store_luma)
+PLM_DEFINE_MC_SSE2_FUNCTIONS(CHROMA, 8, plm_sse2_load_chroma, plm_sse2_store_chroma)
+
+#undef PLM_DEFINE_MC_SSE2_FUNCTIONS
+#undef PLM_DEFINE_MC_SSE2_FUNCTION
+
+#endif // PLM_SIMD_X86
+
+void plm_video_init_kernels(plm_video_t *self) {
+	self->idct_put = plm_video_idct_put;
+	self->idct_add = plm_video_idct_add;
+
+	// The scalar IDCT gains little from a 4x4 variant; only SIMD has one
+	self->idct_put_4x4 = plm_video_idct_put;
+	self->idct_add_4x4 = plm_video_idct_add;
+	self->mc_luma = PLM_VIDEO_MC_LUMA;
+	self->mc_chroma = PLM_VIDEO_MC_CHROMA;
+
+	#ifdef PLM_SIMD_X86
+		if (plm_cpu_has_avx2()) {
+			self->idct_put = plm_video_idct_put_avx2;
+			self->idct_add = plm_video_idct_add_avx2;
+			self->idct_put_4x4 = plm_video_idct_put_4x4_avx2;
+			self->idct_add_4x4 = plm_video_idct_add_4x4_avx2;
 		}
-		else {
-			plm_video_idct(s);
-			PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + s[si]));
-			memset(self->block_data, 0, sizeof(self->block_data));
+		else if (plm_cpu_has_sse2()) {
+			self->idct_put = plm_video_idct_put_sse2;
+			self->idct_add = plm_video_idct_add_sse2;
+			self->idct_put_4x4 = plm_video_idct_put_4x4_sse2;
+			self->idct_add_4x4 = plm_video_idct_add_4x4_sse2;
 		}
-	}
-}
 
-void plm_video_idct(int *block) {
-	int
-		b1, b3, b4, b6, b7, tmp1, tmp2, m0,
-		x0, x1, x2, x3, x4, y3, y4, y5, y6, y7;
+		// Motion compensation works on 16 byte rows, AVX2 has nothing to add
+		if (plm_cpu_has_sse2()) {
+			self->mc_luma = PLM_VIDEO_MC_LUMA_SSE2;
+			self->mc_chroma = PLM_VIDEO_MC_CHROMA_SSE2;
+		}
+	#endif
 
-	// Transform columns
-	for (int i = 0; i < 8; ++i) {
-		b1 = block[4 * 8 + i];
-		b3 = block[2 * 8 + i] + block[6 * 8 + i];
-		b4 = block[5 * 8 + i] - block[3 * 8 + i];
-		tmp1 = block[1 * 8 + i] + block[7 * 8 + i];
-		tmp2 = block[3 * 8 + i] + block[5 * 8 + i];
-		b6 = block[1 * 8 + i] - block[7 * 8 + i];
-		b7 = tmp1 + tmp2;
-		m0 = block[0 * 8 + i];
-		x4 = ((b6 * 473 - b4 * 196 + 128) >> 8) - b7;
-		x0 = x4 - (((tmp1 - tmp2) * 362 + 128) >> 8);
-		x1 = m0 - b1;
-		x2 = (((block[2 * 8 + i] - block[6 * 8 + i]) * 362 + 128) >> 8) - b3;
-		x3 = m0 + b1;
-		y3 = x1 + x2;
-		y4 = x3 + b3;
-		y5 = x1 - x2;
-		y6 = x3 - b3;
-		y7 = -x0 - ((b4 * 473 + b6 * 196 + 128) >> 8);
-		block[0 * 8 + i] = b7 + y4;
-		block[1 * 8 + i] = x4 + y3;
-		block[2 * 8 + i] = y5 - x0;
-		block[3 * 8 + i] = y6 - y7;
-		block[4 * 8 + i] = y6 + y7;
-		block[5 * 8 + i] = x0 + y5;
-		block[6 * 8 + i] = y3 - x4;
-		block[7 * 8 + i] = y4 - b7;
+	// At reduced resolution, every block shrinks by the scale
+	if (self->scale_shift == 1) {
+		self->mc_luma = self->mc_chroma;
+		self->mc_chroma = PLM_VIDEO_MC_4X4;
 	}
-
-	// Transform rows
-	for (int i = 0; i < 64; i += 8) {
-		b1 = block[4 + i];
-		b3 = block[2 + i] + block[6 + i];
-		b4 = block[5 + i] - block[3 + i];
-		tmp1 = block[1 + i] + block[7 + i];
-		tmp2 = block[3 + i] + block[5 + i];
-		b6 = block[1 + i] - block[7 + i];
-		b7 = tmp1 + tmp2;
-		m0 = block[0 + i];
-		x4 = ((b6 * 473 - b4 * 196 + 128) >> 8) - b7;
-		x0 = x4 - (((tmp1 - tmp2) * 362 + 128) >> 8);
-		x1 = m0 - b1;
-		x2 = (((block[2 + i] - block[6 + i]) * 362 + 128) >> 8) - b3;
-		x3 = m0 + b1;
-		y3 = x1 + x2;
-		y4 = x3 + b3;
-		y5 = x1 - x2;
-		y6 = x3 - b3;
-		y7 = -x0 - ((b4 * 473 + b6 * 196 + 128) >> 8);
-		block[0 + i] = (b7 + y4 + 128) >> 8;
-		block[1 + i] = (x4 + y3 + 128) >> 8;
-		block[2 + i] = (y5 - x0 + 128) >> 8;
-		block[3 + i] = (y6 - y7 + 128) >> 8;
-		block[4 + i] = (y6 + y7 + 128) >> 8;
-		block[5 + i] = (x0 + y5 + 128) >> 8;
-		block[6 + i] = (y3 - x4 + 128) >> 8;
-		block[7 + i] = (y4 - b7 + 128) >> 8;
+	else if (self->scale_shift == 2) {
+		self->mc_luma = PLM_VIDEO_MC_4X4;
+		self->mc_chroma = PLM_VIDEO_MC_2X2;
+	}
+	else if (self->scale_shift == 3) {
+		self->mc_luma = PLM_VIDEO_MC_2X2;
+		self->mc_chroma = PLM_VIDEO_MC_1X1;
 	}
 }
 
@@ -3436,17 +7156,20 @@ void plm_video_idct(int *block) {
 	dest[d_index + DEST_OFFSET + GI] = plm_clamp(y - g); \
 	dest[d_index + DEST_OFFSET + BI] = plm_clamp(y + b);
 
+// The C version converts the columns from first_col on; the SIMD versions
+// return how many columns they did.
+
 #define PLM_DEFINE_FRAME_CONVERT_FUNCTION(NAME, BYTES_PER_PIXEL, RI, GI, BI) \
-	void NAME(plm_frame_t *frame, uint8_t *dest, int stride) { \
+	static void NAME##_c(plm_frame_t *frame, uint8_t *dest, int stride, int first_col) { \
 		int cols = frame->width >> 1; \
 		int rows = frame->height >> 1; \
-		int yw = frame->y.width; \
-		int cw = frame->cb.width; \
+		int yw = frame->y.stride; \
+		int cw = frame->cb.stride; \
 		for (int row = 0; row < rows; row++) { \
-			int c_index = row * cw; \
-			int y_index = row * 2 * yw; \
-			int d_index = row * 2 * stride; \
-			for (int col = 0; col < cols; col++) { \
+			int c_index = row * cw + first_col; \
+			int y_index = row * 2 * yw + first_col * 2; \
+			int d_index = row * 2 * stride + first_col * 2 * BYTES_PER_PIXEL; \
+			for (int col = first_col; col < cols; col++) { \
 				int y; \
 				int cr = frame->cr.data[c_index] - 128; \
 				int cb = frame->cb.data[c_index] - 128; \
@@ -3462,8 +7185,220 @@ void plm_video_idct(int *block) {
 				d_index += 2 * BYTES_PER_PIXEL; \
 			} \
 		} \
+	} \
+	void NAME(plm_frame_t *frame, uint8_t *dest, int stride) { \
+		PLM_PROFILE_BEGIN(profile_start); \
+		NAME##_c(frame, dest, stride, PLM_FRAME_CONVERT_SIMD(NAME, frame, dest, stride)); \
+		PLM_PROFILE_END(&plm_frame_profile, PLM_PROFILE_CONVERT, profile_start); \
+	}
+
+#ifdef PLM_SIMD_X86
+
+// The same math on 16 bit lanes. Each constant multiplication is split into a
+// multiple of 65536 and a signed 16 bit rest, e.g. (cr * 104597) >> 16 is
+// cr * 2 + ((cr * -26475) >> 16), which is exact. This gives the offsets of
+// 8 chroma samples, as r, g and b.
+
+static inline PLM_TARGET_SSE2 void plm_sse2_chroma_to_rgb(uint8_t *cb, uint8_t *cr, __m128i *r, __m128i *g, __m128i *b) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i c128 = _mm_set1_epi16(128);
+	__m128i vcr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)cr), zero), c128);
+	__m128i vcb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)cb), zero), c128);
+	*r = _mm_add_epi16(_mm_slli_epi16(vcr, 1), _mm_mulhi_epi16(vcr, _mm_set1_epi16(-26475)));
+	*b = _mm_add_epi16(_mm_slli_epi16(vcb, 1), _mm_mulhi_epi16(vcb, _mm_set1_epi16(1129)));
+
+	// g needs the sum of both products before the shift
+	__m128i k = _mm_setr_epi16(25674, -12258, 25674, -12258, 25674, -12258, 25674, -12258);
+	__m128i g_lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(vcb, vcr), k), 16);
+	__m128i g_hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(vcb, vcr), k), 16);
+	*g = _mm_add_epi16(vcr, _mm_packs_epi32(g_lo, g_hi));
+}
+
+// (y - 16) * 76309 >> 16 for 8 luma samples, widened to 16 bit
+
+static inline PLM_TARGET_SSE2 __m128i plm_sse2_scale_luma(__m128i y) {
+	y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	return _mm_add_epi16(y, _mm_mulhi_epi16(y, _mm_set1_epi16(10773)));
+}
+
+// Write 16 pixels from their channels, which are in byte order in c[0..3].
+// With 4 bytes per pixel, one of them is left as it was in dest.
+
+static inline PLM_TARGET_SSE2 void plm_sse2_store_pixels(uint8_t *d, __m128i *c, int bytes_per_pixel, int alpha) {
+	if (bytes_per_pixel == 3) {
+		uint8_t bytes[3][16];
+		for (int i = 0; i < 3; i++) {
+			_mm_storeu_si128((__m128i *)bytes[i], c[i]);
+		}
+		for (int i = 0; i < 16; i++) {
+			d[i * 3 + 0] = bytes[0][i];
+			d[i * 3 + 1] = bytes[1][i];
+			d[i * 3 + 2] = bytes[2][i];
+		}
+		return;
+	}
+
+	__m128i lo = _mm_unpacklo_epi8(c[0], c[1]);
+	__m128i hi = _mm_unpackhi_epi8(c[0], c[1]);
+	__m128i lo2 = _mm_unpacklo_epi8(c[2], c[3]);
+	__m128i hi2 = _mm_unpackhi_epi8(c[2], c[3]);
+	__m128i pixels[4] = {
+		_mm_unpacklo_epi16(lo, lo2), _mm_unpackhi_epi16(lo, lo2),
+		_mm_unpacklo_epi16(hi, hi2), _mm_unpackhi_epi16(hi, hi2)
+	};
+	__m128i keep = _mm_set1_epi32((int)(0xffu << (alpha * 8)));
+	for (int i = 0; i < 4; i++) {
+		__m128i *p = (__m128i *)(d + i * 16);
+		_mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(p), keep), pixels[i]));
+	}
+}
+
+// Convert 16 pixels of one row
+
+static inline PLM_TARGET_SSE2 void plm_sse2_put_row(
+	uint8_t *d, uint8_t *y, __m128i r, __m128i g, __m128i b,
+	int bytes_per_pixel, int ri, int gi, int bi
+) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i vy = _mm_loadu_si128((__m128i *)y);
+	__m128i y_lo = plm_sse2_scale_luma(_mm_unpacklo_epi8(vy, zero));
+	__m128i y_hi = plm_sse2_scale_luma(_mm_unpackhi_epi8(vy, zero));
+
+	// Each chroma sample covers two pixels
+	__m128i c[4];
+	c[ri] = _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(r, r)), _mm_add_epi16(y_hi, _mm_unpackhi_epi16(r, r)));
+	c[gi] = _mm_packus_epi16(_mm_sub_epi16(y_lo, _mm_unpacklo_epi16(g, g)), _mm_sub_epi16(y_hi, _mm_unpackhi_epi16(g, g)));
+	c[bi] = _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(b, b)), _mm_add_epi16(y_hi, _mm_unpackhi_epi16(b, b)));
+	c[6 - ri - gi - bi] = zero;
+	plm_sse2_store_pixels(d, c, bytes_per_pixel, 6 - ri - gi - bi);
+}
+
+// AVX2 converts both rows that share the chroma samples at once, with one row
+// in each 128 bit lane.
+
+static inline PLM_TARGET_AVX2 __m256i plm_avx2_scale_luma(__m256i y) {
+	y = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+	return _mm256_add_epi16(y, _mm256_mulhi_epi16(y, _mm256_set1_epi16(10773)));
+}
+
+static inline PLM_TARGET_AVX2 void plm_avx2_put_rows(
+	uint8_t *d0, uint8_t *d1, uint8_t *y0, uint8_t *y1, __m128i r, __m128i g, __m128i b,
+	int bytes_per_pixel, int ri, int gi, int bi
+) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i vy = _mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_loadu_si128((__m128i *)y0)),
+		_mm_loadu_si128((__m128i *)y1), 1
+	);
+	__m256i y_lo = plm_avx2_scale_luma(_mm256_unpacklo_epi8(vy, zero));
+	__m256i y_hi = plm_avx2_scale_luma(_mm256_unpackhi_epi8(vy, zero));
+	__m256i vr = _mm256_broadcastsi128_si256(r);
+	__m256i vg = _mm256_broadcastsi128_si256(g);
+	__m256i vb = _mm256_broadcastsi128_si256(b);
+
+	__m256i c[4];
+	c[ri] = _mm256_packus_epi16(_mm256_add_epi16(y_lo, _mm256_unpacklo_epi16(vr, vr)), _mm256_add_epi16(y_hi, _mm256_unpackhi_epi16(vr, vr)));
+	c[gi] = _mm256_packus_epi16(_mm256_sub_epi16(y_lo, _mm256_unpacklo_epi16(vg, vg)), _mm256_sub_epi16(y_hi, _mm256_unpackhi_epi16(vg, vg)));
+	c[bi] = _mm256_packus_epi16(_mm256_add_epi16(y_lo, _mm256_unpacklo_epi16(vb, vb)), _mm256_add_epi16(y_hi, _mm256_unpackhi_epi16(vb, vb)));
+	c[6 - ri - gi - bi] = zero;
+
+	if (bytes_per_pixel == 3) {
+		uint8_t bytes[3][32];
+		for (int i = 0; i < 3; i++) {
+			_mm256_storeu_si256((__m256i *)bytes[i], c[i]);
+		}
+		for (int i = 0; i < 16; i++) {
+			d0[i * 3 + 0] = bytes[0][i];
+			d0[i * 3 + 1] = bytes[1][i];
+			d0[i * 3 + 2] = bytes[2][i];
+			d1[i * 3 + 0] = bytes[0][i + 16];
+			d1[i * 3 + 1] = bytes[1][i + 16];
+			d1[i * 3 + 2] = bytes[2][i + 16];
+		}
+		return;
+	}
+
+	// Pixels 0-3, 4-7, 8-11 and 12-15 of each row, then put the lanes back
+	// together into rows
+	__m256i lo = _mm256_unpacklo_epi8(c[0], c[1]);
+	__m256i hi = _mm256_unpackhi_epi8(c[0], c[1]);
+	__m256i lo2 = _mm256_unpacklo_epi8(c[2], c[3]);
+	__m256i hi2 = _mm256_unpackhi_epi8(c[2], c[3]);
+	__m256i p0 = _mm256_unpacklo_epi16(lo, lo2);
+	__m256i p1 = _mm256_unpackhi_epi16(lo, lo2);
+	__m256i p2 = _mm256_unpacklo_epi16(hi, hi2);
+	__m256i p3 = _mm256_unpackhi_epi16(hi, hi2);
+	__m256i rows[4] = {
+		_mm256_permute2x128_si256(p0, p1, 0x20), _mm256_permute2x128_si256(p2, p3, 0x20),
+		_mm256_permute2x128_si256(p0, p1, 0x31), _mm256_permute2x128_si256(p2, p3, 0x31)
+	};
+	__m256i keep = _mm256_set1_epi32((int)(0xffu << ((6 - ri - gi - bi) * 8)));
+	for (int i = 0; i < 4; i++) {
+		__m256i *p = (__m256i *)((i < 2 ? d0 : d1) + (i & 1) * 32);
+		_mm256_storeu_si256(p, _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(p), keep), rows[i]));
+	}
+}
+
+#define PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS(NAME, BYTES_PER_PIXEL, RI, GI, BI) \
+	PLM_TARGET_SSE2 int NAME##_sse2(plm_frame_t *frame, uint8_t *dest, int stride) { \
+		int cols = (frame->width >> 1) & ~7; \
+		int rows = frame->height >> 1; \
+		int yw = frame->y.stride; \
+		for (int row = 0; row < rows; row++) { \
+			uint8_t *y = frame->y.data + row * 2 * yw; \
+			uint8_t *cb = frame->cb.data + row * frame->cb.stride; \
+			uint8_t *cr = frame->cr.data + row * frame->cr.stride; \
+			uint8_t *d = dest + row * 2 * stride; \
+			for (int col = 0; col < cols; col += 8) { \
+				__m128i r, g, b; \
+				plm_sse2_chroma_to_rgb(cb + col, cr + col, &r, &g, &b); \
+				plm_sse2_put_row(d, y, r, g, b, BYTES_PER_PIXEL, RI, GI, BI); \
+				plm_sse2_put_row(d + stride, y + yw, r, g, b, BYTES_PER_PIXEL, RI, GI, BI); \
+				y += 16; \
+				d += 16 * BYTES_PER_PIXEL; \
+			} \
+		} \
+		return cols; \
+	} \
+	PLM_TARGET_AVX2 int NAME##_avx2(plm_frame_t *frame, uint8_t *dest, int stride) { \
+		int cols = (frame->width >> 1) & ~7; \
+		int rows = frame->height >> 1; \
+		int yw = frame->y.stride; \
+		for (int row = 0; row < rows; row++) { \
+			uint8_t *y = frame->y.data + row * 2 * yw; \
+			uint8_t *cb = frame->cb.data + row * frame->cb.stride; \
+			uint8_t *cr = frame->cr.data + row * frame->cr.stride; \
+			uint8_t *d = dest + row * 2 * stride; \
+			for (int col = 0; col < cols; col += 8) { \
+				__m128i r, g, b; \
+				plm_sse2_chroma_to_rgb(cb + col, cr + col, &r, &g, &b); \
+				plm_avx2_put_rows(d, d + stride, y, y + yw, r, g, b, BYTES_PER_PIXEL, RI, GI, BI); \
+				y += 16; \
+				d += 16 * BYTES_PER_PIXEL; \
+			} \
+		} \
+		return cols; \
 	}
 
+PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS(plm_frame_to_rgb,  3, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS(plm_frame_to_bgr,  3, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS(plm_frame_to_rgba, 4, 0, 1, 2)
+PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS(plm_frame_to_bgra, 4, 2, 1, 0)
+PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS(plm_frame_to_argb, 4, 1, 2, 3)
+PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS(plm_frame_to_abgr, 4, 3, 2, 1)
+
+#undef PLM_DEFINE_FRAME_CONVERT_SIMD_FUNCTIONS
+
+#define PLM_FRAME_CONVERT_SIMD(NAME, FRAME, DEST, STRIDE) ( \
+	plm_cpu_has_avx2() ? NAME##_avx2(FRAME, DEST, STRIDE) : \
+	plm_cpu_has_sse2() ? NAME##_sse2(FRAME, DEST, STRIDE) : 0)
+
+#else
+
+#define PLM_FRAME_CONVERT_SIMD(NAME, FRAME, DEST, STRIDE) 0
+
+#endif // PLM_SIMD_X86
+
 PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgb,  3, 0, 1, 2)
 PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgr,  3, 2, 1, 0)
 PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgba, 4, 0, 1, 2)
@@ -3474,6 +7409,125 @@ PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_abgr, 4, 3, 2, 1)
 
 #undef PLM_PUT_PIXEL
 #undef PLM_DEFINE_FRAME_CONVERT_FUNCTION
+#undef PLM_FRAME_CONVERT_SIMD
+
+
+// YUV layouts. The planes are copied; only the interleaving needs more than
+// memcpy, and that has SSE2 versions working on 16 chroma samples at a time.
+// They return how many samples of the row they did.
+
+#ifdef PLM_SIMD_X86
+
+PLM_TARGET_SSE2 int plm_frame_interleave_row_sse2(uint8_t *d, uint8_t *cb, uint8_t *cr, int cols) {
+	int done = cols & ~15;
+	for (int col = 0; col < done; col += 16) {
+		__m128i vcb = _mm_loadu_si128((__m128i *)(cb + col));
+		__m128i vcr = _mm_loadu_si128((__m128i *)(cr + col));
+		_mm_storeu_si128((__m128i *)(d + col * 2), _mm_unpacklo_epi8(vcb, vcr));
+		_mm_storeu_si128((__m128i *)(d + col * 2 + 16), _mm_unpackhi_epi8(vcb, vcr));
+	}
+	return done;
+}
+
+PLM_TARGET_SSE2 int plm_frame_yuy2_row_sse2(uint8_t *d, uint8_t *y, uint8_t *cb, uint8_t *cr, int cols) {
+	int done = cols & ~15;
+	for (int col = 0; col < done; col += 16) {
+		__m128i vcb = _mm_loadu_si128((__m128i *)(cb + col));
+		__m128i vcr = _mm_loadu_si128((__m128i *)(cr + col));
+		__m128i y0 = _mm_loadu_si128((__m128i *)(y + col * 2));
+		__m128i y1 = _mm_loadu_si128((__m128i *)(y + col * 2 + 16));
+		__m128i c0 = _mm_unpacklo_epi8(vcb, vcr);
+		__m128i c1 = _mm_unpackhi_epi8(vcb, vcr);
+		_mm_storeu_si128((__m128i *)(d + col * 4), _mm_unpacklo_epi8(y0, c0));
+		_mm_storeu_si128((__m128i *)(d + col * 4 + 16), _mm_unpackhi_epi8(y0, c0));
+		_mm_storeu_si128((__m128i *)(d + col * 4 + 32), _mm_unpacklo_epi8(y1, c1));
+		_mm_storeu_si128((__m128i *)(d + col * 4 + 48), _mm_unpackhi_epi8(y1, c1));
+	}
+	return done;
+}
+
+#endif // PLM_SIMD_X86
+
+static void plm_frame_copy_plane(plm_plane_t *plane, uint8_t *dest, int stride, int width, int height) {
+	for (int row = 0; row < height; row++) {
+		memcpy(dest + row * stride, plane->data + row * plane->stride, width);
+	}
+}
+
+void plm_frame_to_yuv420p(
+	plm_frame_t *frame, uint8_t *y, int y_stride,
+	uint8_t *u, int u_stride, uint8_t *v, int v_stride
+) {
+	PLM_PROFILE_BEGIN(profile_start);
+	int cols = (frame->width + 1) >> 1;
+	int rows = (frame->height + 1) >> 1;
+	plm_frame_copy_plane(&frame->y, y, y_stride, frame->width, frame->height);
+	plm_frame_copy_plane(&frame->cb, u, u_stride, cols, rows);
+	plm_frame_copy_plane(&frame->cr, v, v_stride, cols, rows);
+	PLM_PROFILE_END(&plm_frame_profile, PLM_PROFILE_CONVERT, profile_start);
+}
+
+void plm_frame_to_i420(plm_frame_t *frame, uint8_t *dest, int stride) {
+	uint8_t *u = dest + stride * frame->height;
+	uint8_t *v = u + (stride >> 1) * ((frame->height + 1) >> 1);
+	plm_frame_to_yuv420p(frame, dest, stride, u, stride >> 1, v, stride >> 1);
+}
+
+void plm_frame_to_yv12(plm_frame_t *frame, uint8_t *dest, int stride) {
+	uint8_t *v = dest + stride * frame->height;
+	uint8_t *u = v + (stride >> 1) * ((frame->height + 1) >> 1);
+	plm_frame_to_yuv420p(frame, dest, stride, u, stride >> 1, v, stride >> 1);
+}
+
+void plm_frame_to_nv12(plm_frame_t *frame, uint8_t *dest, int stride) {
+	PLM_PROFILE_BEGIN(profile_start);
+	int cols = (frame->width + 1) >> 1;
+	int rows = (frame->height + 1) >> 1;
+	plm_frame_copy_plane(&frame->y, dest, stride, frame->width, frame->height);
+	dest += stride * frame->height;
+
+	for (int row = 0; row < rows; row++) {
+		uint8_t *d = dest + row * stride;
+		uint8_t *cb = frame->cb.data + row * frame->cb.stride;
+		uint8_t *cr = frame->cr.data + row * frame->cr.stride;
+		int col = 0;
+		#ifdef PLM_SIMD_X86
+			if (plm_cpu_has_sse2()) {
+				col = plm_frame_interleave_row_sse2(d, cb, cr, cols);
+			}
+		#endif
+		for (; col < cols; col++) {
+			d[col * 2 + 0] = cb[col];
+			d[col * 2 + 1] = cr[col];
+		}
+	}
+	PLM_PROFILE_END(&plm_frame_profile, PLM_PROFILE_CONVERT, profile_start);
+}
+
+void plm_frame_to_yuy2(plm_frame_t *frame, uint8_t *dest, int stride) {
+	PLM_PROFILE_BEGIN(profile_start);
+	int cols = (frame->width + 1) >> 1;
+	int rows = frame->height;
+	for (int row = 0; row < rows; row++) {
+		uint8_t *d = dest + row * stride;
+		uint8_t *y = frame->y.data + row * frame->y.stride;
+		uint8_t *cb = frame->cb.data + (row >> 1) * frame->cb.stride;
+		uint8_t *cr = frame->cr.data + (row >> 1) * frame->cr.stride;
+		int col = 0;
+		#ifdef PLM_SIMD_X86
+			if (plm_cpu_has_sse2()) {
+				col = plm_frame_yuy2_row_sse2(d, y, cb, cr, cols);
+			}
+		#endif
+		for (; col < cols; col++) {
+			d[col * 4 + 0] = y[col * 2];
+			d[col * 4 + 1] = cb[col];
+			d[col * 4 + 2] = y[col * 2 + 1];
+			d[col * 4 + 3] = cr[col];
+		}
+	}
+	PLM_PROFILE_END(&plm_frame_profile, PLM_PROFILE_CONVERT, profile_start);
+}
 
 
 
@@ -3707,6 +7761,10 @@ struct plm_audio_t {
 	float D[1024];
 	float V[2][1024];
 	float U[32];
+
+	#ifdef PLM_PROFILE
+		plm_profile_t profile;
+	#endif
 };
 
 int plm_audio_find_frame_sync(plm_audio_t *self);
@@ -3793,7 +7851,9 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self) {
 		return NULL;
 	}
 
+	PLM_PROFILE_BEGIN(profile_start);
 	plm_audio_decode_frame(self);
+	PLM_PROFILE_END(&self->profile, PLM_PROFILE_AUDIO, profile_start);
 	self->next_frame_data_size = 0;
 	
 	self->samples.time = self->time;
@@ -3805,6 +7865,16 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self) {
 	return &self->samples;
 }
 
+#ifdef PLM_PROFILE
+plm_profile_t plm_audio_get_profile(plm_audio_t *self) {
+	plm_profile_t profile = self->profile;
+	plm_profile_add(&profile, &self->buffer->profile);
+	memset(&self->profile, 0, sizeof(plm_profile_t));
+	memset(&self->buffer->profile, 0, sizeof(plm_profile_t));
+	return profile;
+}
+#endif
+
 int plm_audio_find_frame_sync(plm_audio_t *self) {
 	size_t i;
 	for (i = self->buffer->bit_index >> 3; i < self->buffer->length-1; i++) {
@@ -4262,4 +8332,169 @@ void plm_audio_idct36(int s[32][3], int ss, float *d, int dp) {
 }
 
 
+
+// -----------------------------------------------------------------------------
+// plm_probe implementation
+
+static const int PLM_START_GOP = 0xB8;
+
+int plm_probe_video(plm_buffer_t *buffer, plm_info_t *info);
+int plm_probe_audio(plm_buffer_t *buffer, plm_info_t *info);
+int plm_probe_packets(plm_buffer_t *buffer, plm_info_t *info);
+
+int plm_probe_sequence_header(const uint8_t *bytes, size_t length, plm_info_t *info) {
+	memset(info, 0, sizeof(plm_info_t));
+
+	// The buffer only reads from the bytes
+	plm_buffer_t buffer;
+	plm_buffer_init_with_memory(&buffer, (uint8_t *)bytes, length);
+	return plm_probe_video(&buffer, info);
+}
+
+int plm_probe_stream(const uint8_t *bytes, size_t length, plm_info_t *info) {
+	memset(info, 0, sizeof(plm_info_t));
+
+	plm_buffer_t buffer;
+	plm_buffer_init_with_memory(&buffer, (uint8_t *)bytes, length);
+
+	// Raw audio starts with a frame sync, raw video with a sequence header
+	if (length >= 2 && bytes[0] == 0xFF && (bytes[1] & 0xE0) == 0xE0) {
+		return plm_probe_audio(&buffer, info);
+	}
+	if (length >= 4 && bytes[0] == 0 && bytes[1] == 0 && bytes[2] == 1 && bytes[3] == PLM_START_SEQUENCE) {
+		return plm_probe_video(&buffer, info);
+	}
+	return plm_probe_packets(&buffer, info);
+}
+
+// Read the sequence header and the GOP header after it, same as
+// plm_video_decode_sequence_header() but without the quantizer matrices.
+
+int plm_probe_video(plm_buffer_t *buffer, plm_info_t *info) {
+	if (
+		plm_buffer_find_start_code(buffer, PLM_START_SEQUENCE) == -1 ||
+		!plm_buffer_has(buffer, 64)
+	) {
+		return FALSE;
+	}
+
+	int width = plm_buffer_read(buffer, 12);
+	int height = plm_buffer_read(buffer, 12);
+	if (width <= 0 || height <= 0) {
+		return FALSE;
+	}
+
+	plm_buffer_skip(buffer, 4); // pixel aspect ratio
+	double framerate = PLM_VIDEO_PICTURE_RATE[plm_buffer_read(buffer, 4)];
+	int bitrate = plm_buffer_read(buffer, 18);
+
+	info->has_sequence_header = TRUE;
+	info->width = width;
+	info->height = height;
+	info->framerate = framerate;
+	info->video_bitrate = bitrate == 0x3FFFF ? 0 : bitrate * 400;
+
+	// Skip the quantizer matrices, extension and user data
+	int start_code;
+	do {
+		start_code = plm_buffer_next_start_code(buffer);
+	} while (
+		start_code == PLM_START_EXTENSION ||
+		start_code == PLM_START_USER_DATA
+	);
+	if (start_code != PLM_START_GOP || !plm_buffer_has(buffer, 27)) {
+		return TRUE;
+	}
+
+	plm_buffer_skip(buffer, 1); // drop_frame_flag
+	int hours = plm_buffer_read(buffer, 5);
+	int minutes = plm_buffer_read(buffer, 6);
+	plm_buffer_skip(buffer, 1); // marker
+	int seconds = plm_buffer_read(buffer, 6);
+	int pictures = plm_buffer_read(buffer, 6);
+
+	info->has_gop_header = TRUE;
+	info->gop_time = hours * 3600 + minutes * 60 + seconds;
+	if (framerate > 0) {
+		info->gop_time += pictures / framerate;
+	}
+	info->closed_gop = plm_buffer_read(buffer, 1);
+	return TRUE;
+}
+
+// Find the first valid MPEG-1 Layer II frame header; the checks are the same
+// as in plm_audio_decode_header().
+
+int plm_probe_audio(plm_buffer_t *buffer, plm_info_t *info) {
+	while (plm_buffer_has(buffer, 32)) {
+		if (plm_buffer_peek(buffer, 11) != PLM_AUDIO_FRAME_SYNC) {
+			plm_buffer_skip(buffer, 8);
+			continue;
+		}
+
+		size_t bit_index = plm_buffer_get_bit_position(buffer);
+		plm_buffer_skip(buffer, 11);
+		int version = plm_buffer_read(buffer, 2);
+		int layer = plm_buffer_read(buffer, 2);
+		plm_buffer_skip(buffer, 1); // protection_bit
+		int bitrate_index = plm_buffer_read(buffer, 4) - 1;
+		int samplerate_index = plm_buffer_read(buffer, 2);
+		plm_buffer_skip(buffer, 2); // padding, f_private
+		int mode = plm_buffer_read(buffer, 2);
+
+		if (
+			version == PLM_AUDIO_MPEG_1 &&
+			layer == PLM_AUDIO_LAYER_II &&
+			bitrate_index >= 0 && bitrate_index <= 13 &&
+			samplerate_index != 3
+		) {
+			info->has_audio_header = TRUE;
+			info->samplerate = PLM_AUDIO_SAMPLE_RATE[samplerate_index];
+			info->channels = mode == PLM_AUDIO_MODE_MONO ? 1 : 2;
+			info->audio_bitrate = PLM_AUDIO_BIT_RATE[bitrate_index] * 1000;
+			return TRUE;
+		}
+
+		// Not a frame header after all; carry on after the first byte
+		plm_buffer_set_bit_position(buffer, bit_index + 8);
+	}
+	return FALSE;
+}
+
+// Go through the packets of an MPEG-PS with a demuxer on the stack, until the
+// video and audio headers have been found in them.
+
+int plm_probe_packets(plm_buffer_t *buffer, plm_info_t *info) {
+	plm_demux_t demux;
+	memset(&demux, 0, sizeof(plm_demux_t));
+	demux.buffer = buffer;
+	demux.start_time = PLM_PACKET_INVALID_TS;
+	demux.duration = PLM_PACKET_INVALID_TS;
+	demux.start_code = -1;
+
+	if (!plm_demux_has_headers(&demux)) {
+		return FALSE;
+	}
+	info->has_system_header = TRUE;
+	info->num_video_streams = demux.num_video_streams;
+	info->num_audio_streams = demux.num_audio_streams;
+
+	int need_video = info->num_video_streams > 0;
+	int need_audio = info->num_audio_streams > 0;
+	plm_packet_t *packet;
+	while ((need_video || need_audio) && (packet = plm_demux_decode_next(&demux))) {
+		plm_buffer_t payload;
+		plm_buffer_init_with_memory(&payload, packet->data, packet->length);
+
+		if (need_video && packet->type == PLM_DEMUX_PACKET_VIDEO_1) {
+			need_video = !plm_probe_video(&payload, info);
+		}
+		else if (need_audio && packet->type == PLM_DEMUX_PACKET_AUDIO_1) {
+			need_audio = !plm_probe_audio(&payload, info);
+		}
+	}
+	return info->has_sequence_header || info->has_audio_header;
+}
+
+
 #endif // PL_MPEG_IMPLEMENTATION
@@ -285,11 +285,11 @@ static GstFlowReturn gst_krkr_demux_sink_chain(GstPad* pad, GstObject* parent, G
 		{
 			if (!filter->videopad)
 			{
-				plm_video_t* vid = plm_video_create_with_buffer(plm_buffer_create_with_memory(pack->data, pack->length, false), true);
-				int width = plm_video_get_width(vid);
-				int height = plm_video_get_height(vid);
-				double fps = plm_video_get_framerate(vid);
-				plm_video_destroy(vid);
+				plm_info_t info;
+				plm_probe_sequence_header(pack->data, pack->length, &info);
+				int width = info.width;
+				int height = info.height;
+				double fps = info.framerate;
 				
 				filter->videopad = gst_pad_new_from_static_template(&demux_videosrc_factory, "video");
 				gst_pad_set_event_function(filter->videopad, GST_DEBUG_FUNCPTR(gst_krkr_demux_videosrc_event));